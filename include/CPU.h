@@ -1,52 +1,163 @@
 #pragma once
+#include <array>
+#include <vector>
+#include <string>
 #include <memory>
+#include <unordered_map>
+#include <functional>
+#include <filesystem>
 
 #include "Memory.h"
+#include "OpcodeProfiler.h"
+#include "GuestProfiler.h"
+#include "Tracer.h"
+#include "TraceComparer.h"
+#include "Coverage.h"
+#include "RecompiledModule.h"
 
-struct Registers
+class Jit;
+class X86Emitter;
+
+// The r8 operand IDs (B, C, D, E, H, L, [HL], A) are XORed with this value to index Registers::r8.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+constexpr unsigned char R8_INDEX_SWAP = 0;
+#else
+constexpr unsigned char R8_INDEX_SWAP = 1;
+#endif
+
+// Count executions & M-Cycles per opcode, enabled with BITDMG_OPCODE_PROFILER
+#ifdef BITDMG_OPCODE_PROFILER
+constexpr bool PROFILE_OPCODES = true;
+#else
+constexpr bool PROFILE_OPCODES = false;
+#endif
+
+// Register file stored as native 16-bit pairs, each 8-bit register overlaps the half of its pair.
+// A takes the slot of the r8 ID 6 ([HL]) so it can be indexed too, F is kept in FlagRegister.
+union Registers
 {
-	unsigned char a = 0x01;
-	unsigned char b = 0x00;
-	unsigned char c = 0x00;
-	unsigned char d = 0x00;
-	unsigned char e = 0x00;
-	unsigned char h = 0x00;
-	unsigned char l = 0x00;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	struct
+	{
+		unsigned char b, c, d, e, h, l, unused, a;
+	};
+#else
+	struct
+	{
+		unsigned char c, b, e, d, l, h, a, unused;
+	};
+#endif
+
+	struct
+	{
+		unsigned short bc, de, hl, unusedPair;
+	};
+
+	unsigned char r8[8];
+	unsigned short r16[4] = {0x0000, 0x0000, 0x0000, 0x0000};
 };
 
+// Flags are evaluated lazily from the last operation that wrote them.
+// result holds the 8-bit result plus the carry/borrow out of bit 7 in bit 8,
+// operands holds both operands XORed together so the carry into bit 4 can be recovered from the result.
 struct FlagRegister
 {
-	bool zero = false;
-	bool subtract = false;
-	bool halfCarry = false;
-	bool carry = false;
+	unsigned short result = 0x0000;
+	unsigned char operands = 0x00;
+	bool subtractOp = false;
+
+	inline bool zero() { return (this->result & 0xFF) == 0; }
+	inline bool subtract() { return this->subtractOp; }
+	inline bool halfCarry() { return ((this->operands ^ this->result) & 0x10) != 0; }
+	inline bool carry() { return (this->result & 0x100) != 0; }
+
+	/* Record an addition.
+	 *  @param lhs First operand.
+	 *  @param rhs Second operand.
+	 *  @param result Full result of lhs + rhs (+ carry), including bit 8.
+	 */
+	inline void setAdd(unsigned char lhs, unsigned char rhs, unsigned int result)
+	{
+		this->result = result;
+		this->operands = lhs ^ rhs;
+		this->subtractOp = false;
+	}
+
+	/* Record a subtraction.
+	 *  @param lhs First operand.
+	 *  @param rhs Second operand.
+	 *  @param result Full result of lhs - rhs (- carry), bit 8 is set on borrow.
+	 */
+	inline void setSub(unsigned char lhs, unsigned char rhs, unsigned int result)
+	{
+		this->result = result & 0x1FF;
+		this->operands = lhs ^ rhs;
+		this->subtractOp = true;
+	}
+
+	/* Record an increment or decrement by 1, the carry flag is kept.
+	 *  @param value Value before the operation.
+	 *  @param result Value after the operation.
+	 *  @param subtract True for a decrement.
+	 */
+	inline void setIncDec(unsigned char value, unsigned char result, bool subtract)
+	{
+		this->result = (this->result & 0x100) | result;
+		this->operands = value ^ 0x01;
+		this->subtractOp = subtract;
+	}
+
+	/* Record a bitwise operation (carry always reset).
+	 *  @param result Result of the operation.
+	 *  @param halfCarry Value of the half carry flag.
+	 */
+	inline void setLogic(unsigned char result, bool halfCarry)
+	{
+		this->result = result;
+		this->operands = result ^ (halfCarry << 4);
+		this->subtractOp = false;
+	}
+
+	/* Record a result that resets the half carry flag (rotations, shifts & DAA).
+	 *  @param result Result of the operation with the carry flag in bit 8.
+	 *  @param subtract Value of the subtract flag.
+	 */
+	inline void setResult(unsigned short result, bool subtract)
+	{
+		this->result = result;
+		this->operands = result & 0xFF;
+		this->subtractOp = subtract;
+	}
+
+	/* Set every flag explicitly.
+	 */
+	inline void set(bool zero, bool subtract, bool halfCarry, bool carry)
+	{
+		this->result = (zero ? 0x000 : 0x001) | (carry << 8);
+		this->operands = halfCarry << 4;
+		this->subtractOp = subtract;
+	}
 
 	// 8 Bits -> ZSHC0000
 	unsigned char toU8()
 	{
 		unsigned char ret = 0x00;
-		ret |= this->zero << 7;
-		ret |= this->subtract << 6;
-		ret |= this->halfCarry << 5;
-		ret |= this->carry << 4;
+		ret |= this->zero() << 7;
+		ret |= this->subtract() << 6;
+		ret |= this->halfCarry() << 5;
+		ret |= this->carry() << 4;
 
 		return ret;
 	}
 
 	void fromU8(unsigned char byte)
 	{
-		this->zero = ((byte & 0b10000000) >> 7 == 1) ? true : false;
-		this->subtract = ((byte & 0b01000000) >> 6 == 1) ? true : false;
-		this->halfCarry = ((byte & 0b00100000) >> 5 == 1) ? true : false;
-		this->carry = ((byte & 0b00010000) >> 4 == 1) ? true : false;
+		this->set(byte & 0b10000000, byte & 0b01000000, byte & 0b00100000, byte & 0b00010000);
 	}
 
 	void reset()
 	{
-		this->zero = false;
-		this->subtract = false;
-		this->halfCarry = false;
-		this->carry = false;
+		this->set(false, false, false, false);
 	}
 };
 
@@ -60,12 +171,279 @@ public:
 	 */
 	int Cycle();
 
+	/* Run opcodes until the next PPU/timer event, the PPU & timers are only advanced at the end or when the CPU accesses their memory.
+	 * Returns early if the CPU halts, enters a polling loop or changes when the next event happens.
+	 * @param cycles M-Cycles until the next event.
+	 * @return Number of M-Cycles taken, -1 if the CPU encountered an error.
+	 */
+	int RunUntil(int cycles);
+
 	/* Check IE & IF to see if there are any pending interrupts & go to the corresponding handler if requested.
 	 * @return M-Cycles taken by the interrupt request.
 	 */
 	int CheckInterrupts();
 
+	/* Skip M-Cycles while halted, only an interrupt can wake the CPU up so the caller must not skip past the next event that could request one.
+	 * @param cycles M-Cycles until the next event.
+	 * @return Number of M-Cycles skipped, 0 if the CPU has to run (not halted or an interrupt is pending).
+	 */
+	int SkipHalt(int cycles);
+
+	/* Check if the CPU is halted waiting for an interrupt.
+	 * @return True if the CPU is halted.
+	 */
+	inline bool IsHalted() { return m_Halted; }
+
+	/* Get the address of the next opcode.
+	 * @return Program counter.
+	 */
+	inline unsigned short GetPC() { return m_PC; }
+
+	/* Check if interrupts are enabled (IME).
+	 * @return True if an enabled interrupt would be serviced.
+	 */
+	inline bool IsIMEEnabled() { return m_IME; }
+
+	/* Check if the CPU stopped on an invalid opcode, RunUntil returns -1 then.
+	 * @return True if the opcode at PC locks the CPU up.
+	 */
+	bool IsLockedUp();
+
+	/* Describe the registers, interrupt state & the bytes at PC on one line (key=value pairs) for crash reports.
+	 * @return CPU state.
+	 */
+	std::string GetStateDump();
+
+	/* Skip M-Cycles while spinning in a polling loop, the loop can only exit once a polled register changes so the caller must not skip past the next event.
+	 * @param cycles M-Cycles until the next event.
+	 * @return Number of M-Cycles skipped (whole loop iterations), 0 if the CPU has to run.
+	 */
+	int SkipIdleLoop(int cycles);
+
+	/* Check if the last backward jump closed a polling loop that only reads registers & compares them.
+	 * @return True if the CPU is at the start of a polling loop.
+	 */
+	inline bool IsIdleLoop() { return m_IdleLoop || (m_JumpedBack && DetectIdleLoop()); }
+
+	/* Get the number of M-Cycles skipped in polling loops since the CPU started.
+	 * @return Skipped M-Cycles.
+	 */
+	inline unsigned long long GetSkippedCycles() { return m_SkippedCycles; }
+
+	/* Set the profiler sampling the emulated code, nullptr to disable it.
+	 * @param profiler Guest profiler.
+	 */
+	void SetGuestProfiler(std::shared_ptr<GuestProfiler> profiler);
+
+	/* Set the tracer recording the CPU state before every opcode, nullptr to disable it.
+	 * @param tracer Instruction tracer.
+	 */
+	void SetTracer(std::shared_ptr<Tracer> tracer);
+
+	/* Set the comparer checking the CPU state against a reference trace before every opcode, nullptr to disable it.
+	 * @param comparer Trace comparer, RunUntil returns -1 once it's finished.
+	 */
+	void SetTraceComparer(std::shared_ptr<TraceComparer> comparer);
+
+	/* Set the bitmap marking every address executed as an opcode, nullptr to disable it.
+	 * @param coverage Code coverage.
+	 */
+	void SetCoverage(std::shared_ptr<Coverage> coverage);
+
+	/* Get the number of opcodes executed since the CPU started.
+	 * @return Executed instruction count.
+	 */
+	inline unsigned long long GetInstructionCount() { return m_InstructionCount; }
+
+	/* Drop the pre-decoded blocks holding a written address, called by Memory on writes to pages with cached code & to the mapper registers.
+	 * @param address Memory address written.
+	 */
+	void InvalidateCode(unsigned short address);
+
+	/* Check every opcode run by the recompiler (BITDMG_JIT) against the interpreter, slow.
+	 * @param verify True to verify.
+	 */
+	void SetJitVerify(bool verify);
+
+	/* Set the module of ROM code translated ahead of time (BITDMG_STATIC_RECOMPILER), nullptr to only interpret, drops the decoded blocks.
+	 * @param module Recompiled module matching the running ROM.
+	 */
+	void SetRecompiledModule(std::shared_ptr<RecompiledModule> module);
+
+	/* Translate the code reachable from the entry points & interrupt vectors of a ROM to C++ functions, one per block.
+	 * Code in switchable banks reached from bank 0 is translated for every bank, blocks that don't match at runtime are interpreted.
+	 * @param cartridge ROM to translate.
+	 * @return C++ source, built with RecompiledModule::Build.
+	 */
+	static std::string Recompile(Cartridge &cartridge);
+
+	/* Log how many opcodes ran as superinstructions (BITDMG_BLOCK_CACHE), per fused sequence.
+	 * @param romName Name of the running ROM.
+	 */
+	void LogSuperinstructions(const std::string &romName);
+
 private:
+	/* Entry of the opcode dispatch tables, the handler is called with the operands decoded from the opcode.
+	 */
+	struct OpcodeEntry
+	{
+		int (CPU::*handler)(unsigned char, unsigned char);
+		unsigned char x;
+		unsigned char y;
+	};
+
+	// Dispatch tables for the main and 0xCB prefixed opcodes, generated at compile time.
+	static const std::array<OpcodeEntry, 256> s_OpcodeTable;
+	static const std::array<OpcodeEntry, 256> s_CBOpcodeTable;
+
+	/* Decode every main opcode into its handler and operands.
+	 * @return Table indexed by opcode.
+	 */
+	static constexpr std::array<OpcodeEntry, 256> BuildOpcodeTable();
+
+	/* Decode every 0xCB prefixed opcode into its handler and operands.
+	 * @return Table indexed by the byte following the prefix.
+	 */
+	static constexpr std::array<OpcodeEntry, 256> BuildCBOpcodeTable();
+
+	// Results of the rotate & shift opcodes with the carry out in bit 8, indexed by [0xCB opcode bits 3-5][carry in << 8 | value].
+	// Operations in order: RLC, RRC, RL, RR, SLA, SRA, SWAP, SRL.
+	static const std::array<std::array<unsigned short, 512>, 8> s_ShiftTable;
+
+	// Results of DAA with the carry out in bit 8, indexed by N << 10 | H << 9 | C << 8 | A.
+	static const std::array<unsigned short, 2048> s_DaaTable;
+
+	/* Compute every rotation & shift of every value.
+	 * @return Table indexed like s_ShiftTable.
+	 */
+	static constexpr std::array<std::array<unsigned short, 512>, 8> BuildShiftTable();
+
+	/* Compute DAA for every value of A & the flags it reads.
+	 * @return Table indexed like s_DaaTable.
+	 */
+	static constexpr std::array<unsigned short, 2048> BuildDaaTable();
+
+	/* Execute an opcode whose handler is resolved at compile time.
+	 * @return M-Cycles the opcode took.
+	 */
+	template <unsigned char Opcode>
+	int Execute();
+
+	/* Common opcode sequences run as a single handler by RunBlocks, marked on their first opcode.
+	 */
+	enum class Superinstruction : unsigned char
+	{
+		None,
+		Copy,	   // LD A, [HL+]; LD [DE], A; INC DE; DEC BC
+		Countdown, // DEC r8; JR NZ, s8
+		Poll,	   // LDH A, [imm8]; AND imm8/r8; JR Z, s8
+		Count
+	};
+
+	// Opcodes in each superinstruction, indexed by Superinstruction
+	static constexpr std::array<unsigned char, (size_t)Superinstruction::Count> SUPERINSTRUCTION_LENGTHS = {0, 4, 2, 3};
+
+	/* Opcode of a pre-decoded block, the handler reads its operands from the block instead of memory.
+	 */
+	struct DecodedOpcode
+	{
+		int (CPU::*handler)(unsigned char, unsigned char);
+		unsigned char x;
+		unsigned char y;
+		unsigned char opcode;		 // Main opcode, 0xCB for prefixed ones
+		unsigned char operandOffset; // Bytes before the operands (2 after the 0xCB prefix)
+		unsigned short address;
+		Superinstruction fused = Superinstruction::None; // Sequence starting at this opcode
+	};
+
+	/* State shared between RunBlocks & native blocks (BITDMG_JIT).
+	 */
+	struct JitContext
+	{
+		int budget;
+		int elapsed;
+		int pending; // M-Cycles of native opcodes not added to Memory yet
+
+		// State before the verified opcode
+		Registers registers;
+		FlagRegister flags;
+		unsigned short sp;
+	};
+
+	// Native block, returns what RunBlocks does next (JIT_CONTINUE or JIT_RETURN)
+	using JitFunction = int (*)(CPU *, JitContext *);
+
+	static constexpr int JIT_STAY = 0;	   // Keep running native code (JitExecute only)
+	static constexpr int JIT_CONTINUE = 1; // Continue in RunBlocks from PC
+	static constexpr int JIT_RETURN = 2;   // RunBlocks returns the elapsed M-Cycles
+
+	// Block runs before it is recompiled
+	static constexpr unsigned int JIT_THRESHOLD = 32;
+
+	/* Straight-line run of opcodes, ends after the first unconditional jump, call, return or HALT/STOP.
+	 */
+	struct Block
+	{
+		unsigned short start;
+		unsigned short end; // First address after the block
+		std::vector<DecodedOpcode> opcodes;
+		std::vector<unsigned char> bytes; // Code from start to end, operands are read from here
+
+		JitFunction native = nullptr;
+		unsigned int runs = 0;
+		RecompiledFunction recompiled = nullptr; // Translation loaded from a RecompiledModule
+	};
+
+	/* Address range of a block in RAM, used to find the blocks a write invalidates.
+	 */
+	struct CodeRange
+	{
+		unsigned short start;
+		unsigned short end;
+	};
+
+	/* Direct mapped entry in front of the block map.
+	 */
+	struct BlockLookup
+	{
+		unsigned int key;
+		Block *block;
+	};
+
+	static constexpr size_t MAX_BLOCK_LENGTH = 32;
+
+	/* Opcodes native or fused code is about to run, marked in the coverage once it returns.
+	 */
+	struct CoverageRun
+	{
+		std::array<unsigned short, MAX_BLOCK_LENGTH> addresses; // Copied, the block can be dropped while it runs
+		size_t count;
+		unsigned char bank;
+		unsigned long long startCount;
+	};
+
+	/* Get the size of an opcode including its operands.
+	 * @param opcode Main opcode.
+	 * @return Length in bytes.
+	 */
+	static constexpr int GetOpcodeLength(unsigned char opcode);
+
+	/* Check if an opcode always leaves the straight-line code (JP, JR, CALL, RET, RETI, RST, HALT, STOP).
+	 * @param opcode Main opcode.
+	 * @return True if the opcode ends a block.
+	 */
+	static constexpr bool EndsBlock(unsigned char opcode);
+
+	/* Adapt a handler without operands to the dispatch table signature.
+	 */
+	template <int (CPU::*Handler)()>
+	int OpNoArgs(unsigned char, unsigned char) { return (this->*Handler)(); }
+
+	/* Adapt a handler with a single operand to the dispatch table signature.
+	 */
+	template <int (CPU::*Handler)(unsigned char)>
+	int OpOneArg(unsigned char x, unsigned char) { return (this->*Handler)(x); }
+
 	Registers m_Registers;
 	FlagRegister m_FlagRegister;
 
@@ -76,8 +454,116 @@ private:
 	bool m_Halted;
 	bool m_HaltBug;
 
+	// Polling loop detection, set by jumps that go backwards
+	bool m_JumpedBack;
+	bool m_IdleLoop;
+	unsigned short m_LoopEnd;
+	unsigned short m_RejectedLoop;
+
+	unsigned long long m_InstructionCount;
+	unsigned long long m_SkippedCycles;
+
 	std::shared_ptr<Memory> m_Mem;
 
+	OpcodeProfiler<PROFILE_OPCODES> m_Profiler;
+	std::shared_ptr<GuestProfiler> m_GuestProfiler;
+	std::shared_ptr<Tracer> m_Tracer;
+	std::shared_ptr<TraceComparer> m_TraceComparer;
+	std::shared_ptr<Coverage> m_Coverage;
+
+	// Pre-decoded blocks keyed by (bank << 16) | address, only ROM, WRAM & HRAM code is cached
+	std::unordered_map<unsigned int, Block> m_Blocks;
+	std::array<BlockLookup, 1024> m_BlockLookup;
+	std::array<std::vector<CodeRange>, Memory::CODE_PAGES> m_PageBlocks;
+	const unsigned char *m_Operands; // Operands of the running pre-decoded opcode, nullptr to fetch from memory
+	std::array<const unsigned char *, 2> m_CodeWindows; // Mapped ROM at 0x0000-0x3FFF & 0x4000-0x7FFF, nullptr until code runs there or after a mapper write
+	bool m_CodeChanged;
+
+	// Superinstruction runs & the opcodes they covered, indexed by Superinstruction
+	std::array<unsigned long long, (size_t)Superinstruction::Count> m_FusedRuns = {};
+	std::array<unsigned long long, (size_t)Superinstruction::Count> m_FusedOpcodes = {};
+
+	// Recompiler for hot blocks, created once the first block gets hot
+	std::shared_ptr<Jit> m_Jit;
+	bool m_JitVerify;
+
+	// ROM code translated ahead of time, bound to blocks as they get decoded
+	std::shared_ptr<RecompiledModule> m_Recompiled;
+
+	/* Read a byte of code (opcode or immediate), straight from the mapped ROM region when it's in ROM.
+	 * @param address Address of the byte.
+	 * @return Byte at the address.
+	 */
+	inline unsigned char ReadCode(unsigned short address)
+	{
+		if (address <= 0x7FFF)
+		{
+			const unsigned char *window = m_CodeWindows[address >> 14];
+			if (window != nullptr) return window[address & 0x3FFF];
+		}
+
+		return ReadCodeSlow(address);
+	}
+
+	/* Read a byte of code through Memory, mapping the ROM region holding it for the next reads.
+	 * @param address Address of the byte.
+	 * @return Byte at the address.
+	 */
+	unsigned char ReadCodeSlow(unsigned short address);
+
+	/* Fetch an 8-bit immediate operand.
+	 * @return Byte at PC.
+	 */
+	inline unsigned char FetchU8()
+	{
+#ifdef BITDMG_BLOCK_CACHE
+		if (m_Operands != nullptr)
+		{
+			m_PC++;
+			return *m_Operands++;
+		}
+#endif
+		return ReadCode(m_PC++);
+	}
+
+	/* Fetch a 16-bit immediate operand.
+	 * @return Two bytes at PC.
+	 */
+	inline unsigned short FetchU16()
+	{
+#ifdef BITDMG_BLOCK_CACHE
+		if (m_Operands != nullptr)
+		{
+			unsigned char lsb = FetchU8();
+			unsigned char msb = FetchU8();
+			return ((unsigned short)msb << 8) | lsb;
+		}
+#endif
+		unsigned char lsb = ReadCode(m_PC++);
+		unsigned char msb = ReadCode(m_PC++);
+		return ((unsigned short)msb << 8) | lsb;
+	}
+
+	/* Push a 16-bit value, stacks in WRAM & HRAM are written directly and the others through Memory::WriteU16Stack.
+	 * @param value Value to push.
+	 */
+	inline void PushU16(unsigned short value)
+	{
+		m_SP -= 2;
+		if (Memory::IsDirectStack(m_SP)) m_Mem->WriteStackDirect(m_SP, value);
+		else m_Mem->WriteU16Stack(m_SP + 1, value);
+	}
+
+	/* Pop a 16-bit value, stacks in WRAM & HRAM are read directly and the others through Memory::ReadU16.
+	 * @return Value popped.
+	 */
+	inline unsigned short PopU16()
+	{
+		unsigned short value = Memory::IsDirectStack(m_SP) ? m_Mem->ReadStackDirect(m_SP) : m_Mem->ReadU16(m_SP);
+		m_SP += 2;
+		return value;
+	}
+
 	/* Set value to 8-bit register.
 	 *  @param reg Register ID (B, C, D, E, H, L, memory at HL, A).
 	 *  @param value Value to write to register.
@@ -106,6 +592,173 @@ private:
 	 */
 	void Log();
 
+	/* Get the ROM bank mapped at an address.
+	 * @param address Memory address.
+	 * @return ROM bank, 0 outside of the switchable ROM area.
+	 */
+	inline unsigned char GetBank(unsigned short address) { return (address >= 0x4000 && address <= 0x7FFF) ? m_Mem->GetRomBank() : 0; }
+
+	/* Check if anything observes every opcode (profilers, tracer, trace comparer), native & fused code is skipped then.
+	 * Coverage is marked per run of native & fused code instead (see BeginCoverageRun).
+	 * @return True if opcodes have to run one at a time.
+	 */
+	inline bool IsInstrumented() { return PROFILE_OPCODES || m_GuestProfiler || m_Tracer || m_TraceComparer; }
+
+	/* Feed the guest profiler & tracer the M-Cycles that passed.
+	 * @param cycles M-Cycles taken.
+	 */
+	inline void Instrument(int cycles)
+	{
+		if (m_GuestProfiler && m_GuestProfiler->AddCycles(cycles)) m_GuestProfiler->Sample(m_PC, GetBank(m_PC));
+		if (m_Tracer) m_Tracer->AddCycles(cycles);
+	}
+
+	/* Record the state before the opcode at PC, called once interrupts are dispatched so handlers start with their own record.
+	 */
+	inline void TraceOpcode()
+	{
+		if (m_Tracer || m_TraceComparer) Trace();
+	}
+
+	/* Queue a trace record & compare it with the reference trace.
+	 */
+	void Trace();
+
+	/* Get the CPU state traced before an opcode.
+	 * @return Trace record, without cycle stamp.
+	 */
+	TraceRecord GetTraceRecord();
+
+	/* Run opcodes in a threaded interpreter loop, same as RunUntil.
+	 * @param budget M-Cycles to run for.
+	 * @return Number of M-Cycles taken, -1 if the CPU encountered an error.
+	 */
+	int RunThreaded(int budget);
+
+	/* Run pre-decoded blocks, same as RunUntil.
+	 * @param budget M-Cycles to run for.
+	 * @return Number of M-Cycles taken, -1 if the CPU encountered an error.
+	 */
+	int RunBlocks(int budget);
+
+	/* Find the block starting at an address, decoding it on the first run.
+	 * @param address Address of the first opcode.
+	 * @return Block, nullptr if the code can't be cached (outside of ROM, WRAM & HRAM).
+	 */
+	Block *GetBlock(unsigned short address);
+
+	/* Decode the opcodes from an address until the end of the straight-line code.
+	 * @param start Address of the first opcode.
+	 * @param block Output block.
+	 * @param read Memory to decode from (ReadU8Unfiltered at runtime, a ROM bank when recompiling).
+	 * @return True if at least one opcode was decoded.
+	 */
+	static bool DecodeBlock(unsigned short start, Block &block, const std::function<unsigned char(unsigned short)> &read);
+
+	/* Check if a superinstruction starts at an opcode of a decoded block.
+	 * @param opcodes Opcodes of the block.
+	 * @param index Index of the first opcode.
+	 * @return Fused sequence, Superinstruction::None if there is none.
+	 */
+	static Superinstruction MatchSuperinstruction(const std::vector<DecodedOpcode> &opcodes, size_t index);
+
+	/* Run a fused sequence of a block with the same M-Cycles, flags & memory timing as its opcodes.
+	 * Stops early wherever RunBlocks would do more than run the next opcode (budget, interrupt, changed code).
+	 * @param block Running block.
+	 * @param next Index of the first opcode, set to the index of the opcode at PC.
+	 * @param budget M-Cycles RunBlocks runs for.
+	 * @param elapsed M-Cycles taken by RunBlocks, updated.
+	 * @return True if RunBlocks has to return (schedule change or polling loop).
+	 */
+	bool RunSuperinstruction(Block *block, size_t &next, int budget, int &elapsed);
+
+	/* Remember the opcodes native or fused code may run, they skip the per opcode coverage marks.
+	 * @param block Block about to run.
+	 * @param first Index of the first opcode.
+	 * @param count Opcodes the run can go through.
+	 * @param run Output.
+	 */
+	void BeginCoverageRun(const Block &block, size_t first, size_t count, CoverageRun &run);
+
+	/* Mark the opcodes the run went through, straight-line code retires them in order.
+	 * @param run Opcodes remembered by BeginCoverageRun.
+	 */
+	void EndCoverageRun(const CoverageRun &run);
+
+	/* Recompile a block to x86-64, register only opcodes run natively & the others call their handler through JitExecute.
+	 * @param block Hot block.
+	 */
+	void CompileBlock(Block &block);
+
+	/* Emit the native code of a register only opcode.
+	 * @param x86 Output code.
+	 * @param decoded Opcode.
+	 * @param operands Immediate operands.
+	 * @param cycles Output M-Cycles taken.
+	 * @return False if the opcode has to run through its handler.
+	 */
+	bool EmitNative(X86Emitter &x86, const DecodedOpcode &decoded, const unsigned char *operands, int &cycles);
+
+	/* Run an opcode of a native block through its handler, then check what RunBlocks would before the next opcode.
+	 * @param cpu CPU running the block.
+	 * @param block Native block.
+	 * @param index Opcode index in the block.
+	 * @param context Native block state.
+	 * @return JIT_STAY if the native code can go on with the next opcode, what RunBlocks does next otherwise.
+	 */
+	static int JitExecute(CPU *cpu, Block *block, int index, JitContext *context);
+
+	/* Save the state before a native opcode (--jit-verify).
+	 * @param cpu CPU running the block.
+	 * @param context Native block state.
+	 */
+	static void JitVerifyBegin(CPU *cpu, JitContext *context);
+
+	/* Run the opcode again through its handler from the saved state & log any difference with the native code (--jit-verify).
+	 * @param cpu CPU running the block.
+	 * @param context Native block state.
+	 * @param block Native block.
+	 * @param index Opcode index in the block.
+	 * @param cycles M-Cycles counted by the native code.
+	 */
+	static void JitVerifyEnd(CPU *cpu, JitContext *context, Block *block, int index, int cycles);
+
+	/* Write the C++ translation of a register only opcode.
+	 * @param code Output code.
+	 * @param decoded Opcode.
+	 * @param operands Immediate operands.
+	 * @param cycles Output M-Cycles taken.
+	 * @return False if the opcode has to run through its handler.
+	 */
+	static bool EmitRecompiled(std::string &code, const DecodedOpcode &decoded, const unsigned char *operands, int &cycles);
+
+	/* Run an opcode of a recompiled block through its handler (RecompiledState::execute).
+	 * @param state State of the recompiled block.
+	 * @param index Opcode index in the block.
+	 * @return Same as JitExecute.
+	 */
+	static int RecompiledExecute(RecompiledState *state, int index);
+
+	/* Remember a taken backward jump, the loop it closes is checked for polling before the next opcode.
+	 * @param branchAddress Address of the jump opcode.
+	 */
+	inline void JumpBack(unsigned short branchAddress)
+	{
+		m_JumpedBack = true;
+		m_LoopEnd = branchAddress;
+	}
+
+	/* Check that the loop from PC to the last backward jump only loads A from memory that doesn't change between PPU/timer events and tests it.
+	 * @return True if the loop is a polling loop.
+	 */
+	bool DetectIdleLoop();
+
+	/* Check if polling an address is free of side effects and it only changes on PPU/timer events or interrupts.
+	 * @param address Address read by the loop.
+	 * @return True if the address can be polled.
+	 */
+	bool IsPollableAddress(unsigned short address);
+
 #pragma region DOUBLE REGISTERS
 	void SetAF(unsigned short value);
 	void SetBC(unsigned short value);
@@ -120,13 +773,13 @@ private:
 
 #pragma region OPCODES
 
-	/* Check if opcode is in valid region.
+	/* Opcode outside the valid region, the CPU stays at the same address.
 	 */
-	bool IsValidOpcode(unsigned char opcode);
+	int InvalidOpcode(unsigned char, unsigned char);
 
-	/* Stop execution and print opcode.
+	/* Fetch the byte after the 0xCB prefix and run it from the CB table.
 	 */
-	int UninplementedOpcode(int opcode);
+	int PrefixCB(unsigned char, unsigned char);
 
 	int NOP();							 // NOP
 	int LD_r16_imm16(unsigned char reg); // LD r16, imm16
@@ -194,6 +847,13 @@ private:
 	int DI();							  // DI
 	int EI();							  // EI
 
+	/* Rotate or shift a register through s_ShiftTable (shared by the 0xCB rotate & shift opcodes).
+	 * @param reg Register ID.
+	 * @param operation Index in s_ShiftTable.
+	 * @return M-Cycles taken.
+	 */
+	int ShiftR8(unsigned char reg, unsigned char operation);
+
 	int RLC_r8(unsigned char reg);				   // RLC r8
 	int RRC_r8(unsigned char reg);				   // RRC r8
 	int RL_r8(unsigned char reg);				   // RL r8
@@ -206,4 +866,41 @@ private:
 	int RES(unsigned char bit, unsigned char reg); // RES b3, r8
 	int SET(unsigned char bit, unsigned char reg); // SET b3, r8
 #pragma endregion
-};
\ No newline at end of file
+};
+
+constexpr int CPU::GetOpcodeLength(unsigned char opcode)
+{
+	switch (opcode)
+	{
+	// LD r16, imm16, LD [imm16], SP, JP (cond), CALL (cond), LD [imm16], A, LD A, [imm16]
+	case 0x01: case 0x11: case 0x21: case 0x31: case 0x08:
+	case 0xC2: case 0xCA: case 0xD2: case 0xDA: case 0xC3:
+	case 0xC4: case 0xCC: case 0xD4: case 0xDC: case 0xCD:
+	case 0xEA: case 0xFA:
+		return 3;
+
+	// LD r8, imm8, JR (cond), ALU A, imm8, LDH, ADD SP, imm8, LD HL, SP + imm8, 0xCB prefix
+	case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x36: case 0x3E:
+	case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+	case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+	case 0xE0: case 0xF0: case 0xE8: case 0xF8: case 0xCB:
+		return 2;
+
+	default:
+		return 1;
+	}
+}
+
+constexpr bool CPU::EndsBlock(unsigned char opcode)
+{
+	switch (opcode)
+	{
+	case 0x18: case 0xC3: case 0xE9: case 0xCD: case 0xC9: case 0xD9: // JR, JP, JP HL, CALL, RET, RETI
+	case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF: // RST
+	case 0x76: case 0x10: // HALT, STOP
+		return true;
+
+	default:
+		return false;
+	}
+}
@@ -48,22 +48,51 @@ public:
 	 */
 	inline std::string GetCartName() { return m_CartName; }
 
+	/* Fetch the ROM bank mapped at 0x4000-0x7FFF.
+	 * @returns Current ROM bank.
+	 */
+	inline unsigned char GetRomBank() { return m_RomBank; }
+
+	/* Fetch the number of 16KiB ROM banks.
+	 * @returns ROM bank count.
+	 */
+	inline int GetRomBankCount() { return (int)(m_Rom.size() / 0x4000); }
+
+	/* Compute the CRC-32 of the whole ROM, used to identify it in caches.
+	 * @returns ROM checksum.
+	 */
+	unsigned int GetChecksum();
+
+	/* Get the byte at the address in cartridge ROM with a given bank mapped (the current bank is ignored).
+	 *  @param bank ROM bank mapped at 0x4000-0x7FFF.
+	 *  @param address Memory address to access.
+	 *  @return Byte at memory address, 0xFF past the end of the ROM.
+	 */
+	unsigned char ReadBankedU8(int bank, int address);
+
+	/* Get the 16KiB of ROM mapped at an address (bank 0 or the current bank), valid until the next mapper write.
+	 *  @param address Memory address in 0x0000-0x7FFF.
+	 *  @return Start of the mapped region, nullptr if it is past the end of the ROM.
+	 */
+	const unsigned char *GetRomRegion(int address);
+
 	/* Get the byte at the address in cartridge ROM (takes into account memory banking).
 	 *  @param address Memory address to access.
 	 *  @return Byte at memory address.
 	 */
-	unsigned char ReadU8(int address);
+	inline unsigned char ReadU8(int address) { return m_Rom[address < 0x4000 ? address : address + m_RomBankOffset]; }
 
 	/* Get the two bytes starting at the address in cartridge ROM (takes into account memory banking).
 	 *  @param address Memory address of first byte.
 	 *  @return Two bytes at memory address.
 	 */
-	unsigned short ReadU16(int address);
+	inline unsigned short ReadU16(int address) { return ((unsigned short)ReadU8(address + 1) << 8) | ReadU8(address); }
+
 	/* Get the byte at the address in cartridge RAM.
 	 *  @param address Memory address to access.
 	 *  @return Byte at memory address.
 	 */
-	unsigned char ReadU8RAM(int address);
+	inline unsigned char ReadU8RAM(int address) { return (this->*m_MapperAccess.readU8RAM)(address); }
 
 	/* Get the two bytes starting at the address in cartridge RAM.
 	 *  @param address Memory address of first byte.
@@ -75,7 +104,7 @@ public:
 	 *  @param address Memory address to access.
 	 *  @param value Value to write at memory address.
 	 */
-	void WriteU8RAM(int address, unsigned char value);
+	inline void WriteU8RAM(int address, unsigned char value) { (this->*m_MapperAccess.writeU8RAM)(address, value); }
 
 
 	/* Write the two bytes to the address and the next address in cartridge RAM.
@@ -95,9 +124,18 @@ public:
 	 *  @param address Memory address to write to.
 	 *  @param value Value to write at address.
 	 */
-	void CheckROMWrite(int address, unsigned char value);
+	inline void CheckROMWrite(int address, unsigned char value) { (this->*m_MapperAccess.checkROMWrite)(address, value); }
 
 private:
+	/* Accessors that depend on the mapper, instantiated for every mapper & picked once when the ROM is loaded.
+	 */
+	struct MapperAccess
+	{
+		unsigned char (Cartridge::*readU8RAM)(int);
+		void (Cartridge::*writeU8RAM)(int, unsigned char);
+		void (Cartridge::*checkROMWrite)(int, unsigned char);
+	};
+
 	std::vector<unsigned char> m_Rom;
 	std::vector<unsigned char> m_Ram;
 	std::string m_CartName;
@@ -105,6 +143,8 @@ private:
 	CartridgeHardware m_Hardware;
 
 	unsigned char m_RomBank;
+	size_t m_RomBankOffset; // Added to 0x4000-0x7FFF addresses to reach the current bank in m_Rom
+	MapperAccess m_MapperAccess;
 	bool m_IsValid;
 
 	bool m_RamEnabled;
@@ -113,6 +153,27 @@ private:
 	 */
 	void SetHardware(Mapper mapper, bool ram, bool battery, bool timer, bool rumble, bool sensor);
 
+	/* Get the accessors of a mapper, unimplemented mappers behave as Mapper::None.
+	 * @return Accessors instantiated for the mapper.
+	 */
+	template <Mapper M>
+	static MapperAccess GetMapperAccess();
+
+	/* Get the byte at the address in cartridge RAM, see ReadU8RAM.
+	 */
+	template <Mapper M>
+	unsigned char ReadU8RAMMapped(int address);
+
+	/* Write to the byte at the address in cartridge RAM, see WriteU8RAM.
+	 */
+	template <Mapper M>
+	void WriteU8RAMMapped(int address, unsigned char value);
+
+	/* Update the mapper registers on a write to ROM, see CheckROMWrite.
+	 */
+	template <Mapper M>
+	void CheckROMWriteMapped(int address, unsigned char value);
+
 	/* Save contents of the cartridge's RAM to a file.
 	 */
 	void SaveGameToFile();
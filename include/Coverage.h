@@ -0,0 +1,58 @@
+#pragma once
+#include <vector>
+#include <filesystem>
+
+/* Bitmap of the addresses executed as opcodes: one bit per ROM byte (bank & offset) and one per address from 0x8000 (VRAM, RAM, OAM & HRAM).
+ * Written when destroyed, OR-ed into the file already there if it was made for the same ROM so batch runs add up.
+ *
+ * File layout (little endian): MAGIC, CRC-32 of the ROM (u32), ROM bank count (u32),
+ * then bank count * 2KiB of ROM bits and 4KiB of bits for 0x8000-0xFFFF. Bit n of a bitmap is byte n / 8, bit n % 8.
+ */
+class Coverage
+{
+public:
+	/* @param outputPath File where the bitmap is written when the coverage is destroyed.
+	 * @param romBanks Number of 16KiB ROM banks, sizes the ROM bitmap.
+	 * @param romChecksum CRC-32 of the ROM, files of other ROMs are overwritten instead of merged.
+	 */
+	Coverage(std::filesystem::path outputPath, int romBanks, unsigned int romChecksum);
+	~Coverage();
+
+	/* Mark the address of an opcode as executed.
+	 * @param address Address of the opcode.
+	 * @param bank ROM bank mapped at 0x4000-0x7FFF.
+	 */
+	inline void Mark(unsigned short address, unsigned char bank)
+	{
+		if (address >= 0x8000) Set(m_Ram, address - 0x8000);
+		else Set(m_Rom, address < 0x4000 ? address : (size_t)bank * 0x4000 + (address - 0x4000));
+	}
+
+	// Written at the start of every coverage file
+	static constexpr char MAGIC[8] = {'B', 'D', 'M', 'G', 'C', 'O', 'V', '1'};
+
+private:
+	std::vector<unsigned char> m_Rom;
+	std::vector<unsigned char> m_Ram;
+
+	std::filesystem::path m_OutputPath;
+	unsigned int m_RomBanks;
+	unsigned int m_RomChecksum;
+
+	/* Set a bit, bits past the end of the bitmap (banks the ROM doesn't have) are ignored.
+	 * @param bits Bitmap.
+	 * @param index Bit to set.
+	 */
+	static inline void Set(std::vector<unsigned char> &bits, size_t index)
+	{
+		if ((index >> 3) < bits.size()) bits[index >> 3] |= 1 << (index & 7);
+	}
+
+	/* OR the bitmaps of the output file into this run's, if it was made for the same ROM.
+	 */
+	void Merge();
+
+	/* Write the bitmaps & log how much of the ROM ran.
+	 */
+	void Save();
+};
@@ -7,16 +7,64 @@
 #include "Cartridge.h"
 #include "CPU.h"
 #include "PPU.h"
+#include "Watchdog.h"
 
 class GameBoy
 {
 public:
 	GameBoy(std::filesystem::path romPath, SDL_Window *window);
 
+	/* Log the superinstruction hit rate of the ROM (BITDMG_BLOCK_CACHE).
+	 */
+	~GameBoy();
+
 	/* Execute a frame of the GameBoy game.
 	 */
 	void Update();
 
+	/* Emulate frames as fast as possible (no input, rendering or frame limit) and log the achieved speed.
+	 * @param frames Number of frames to emulate.
+	 */
+	void Benchmark(int frames);
+
+	/* Sample the emulated code's call stacks and write them as folded stacks when the emulator closes.
+	 * @param outputPath File to write the folded stacks to.
+	 * @param symbolPath RGBDS/no$gmb .sym file used to name addresses (optional).
+	 */
+	void EnableGuestProfiler(std::filesystem::path outputPath, std::filesystem::path symbolPath);
+
+	/* Record the CPU state before every opcode to a binary trace (see Tracer::ConvertToText).
+	 * @param tracePath File to write the trace to.
+	 */
+	void EnableTracer(std::filesystem::path tracePath);
+
+	/* Compare the CPU state before every opcode against a reference trace, the emulator stops at the first mismatch.
+	 * @param referencePath gameboy-doctor text log or binary trace.
+	 */
+	void EnableTraceComparer(std::filesystem::path referencePath);
+
+	/* Mark every ROM byte & RAM address executed as an opcode and write the bitmap when the emulator closes (see Coverage).
+	 * @param coveragePath File to write the coverage to, merged with it if it was made for the same ROM.
+	 */
+	void EnableCoverage(std::filesystem::path coveragePath);
+
+	/* Run every opcode recompiled by the JIT (BITDMG_JIT) on the interpreter too and log the differences.
+	 */
+	void EnableJitVerify();
+
+	/* Run the ROM code translated ahead of time (BITDMG_STATIC_RECOMPILER), translating & building it on the first run of the ROM.
+	 */
+	void EnableRecompiledCode();
+
+	/* Stop the emulator as soon as the game can't make progress anymore (see Watchdog) and log why along with the CPU state.
+	 */
+	void EnableWatchdog();
+
+	/* Get why the watchdog stopped the emulator.
+	 * @return Hang reason, HangReason::None if it didn't.
+	 */
+	inline HangReason GetHangReason() { return m_HangReason; }
+
 	/* Check that the GameBoy has all required components to run.
 	 * @return True if the GameBoy can run correctly.
 	 */
@@ -42,11 +90,33 @@ private:
 
 	bool m_InputBuffer[8];
 
+	std::shared_ptr<Watchdog> m_Watchdog;
+	HangReason m_HangReason;
+
 	int m_DividerCycles;
 	int m_TimerCycles;
 
+	/* Run the CPU, PPU and timers for the duration of a frame.
+	 */
+	void RunFrame();
+
+	/* Check for a hang at the end of a frame (or once the CPU stopped) and stop the emulator if there's one.
+	 */
+	void CheckWatchdog();
+
 	/* Handle DIV and TIMA timers and request their interrupts.
 	 * @param mCycles CPU M-Cycles taken during last operation.
 	 */
 	void HandleTimer(int cycles);
+
+	/* Get the TIMA increment period selected in TAC.
+	 * @param TAC Value of the timer control register.
+	 * @return M-Cycles between TIMA increments.
+	 */
+	int GetTimerFrequency(unsigned char TAC);
+
+	/* Get how long until the next event that could request an interrupt (PPU mode change, TIMA overflow) or the end of the frame.
+	 * @return M-Cycles until the next event, at least 1.
+	 */
+	int GetCyclesUntilNextEvent();
 };
@@ -0,0 +1,84 @@
+#pragma once
+#include <vector>
+#include <map>
+#include <string>
+#include <filesystem>
+
+/* Sampling profiler for the emulated code, keeps a shadow call stack and writes folded stacks (flamegraph.pl, speedscope, ...).
+ * Addresses are resolved through RGBDS/no$gmb .sym files ("BB:AAAA Name" per line).
+ */
+class GuestProfiler
+{
+public:
+	/* @param outputPath File where the folded stacks are written when the profiler is destroyed.
+	 * @param period M-Cycles between samples.
+	 */
+	GuestProfiler(std::filesystem::path outputPath, int period = 1024);
+	~GuestProfiler();
+
+	/* Load symbols used to name the sampled addresses.
+	 * @param symbolPath Path to the .sym file.
+	 * @return True if the file could be read.
+	 */
+	bool LoadSymbols(std::filesystem::path symbolPath);
+
+	/* Push a frame to the shadow call stack (CALL, RST & interrupt dispatch).
+	 * @param returnAddress Address pushed to the stack, names the calling function.
+	 * @param bank ROM bank of the return address.
+	 * @param sp Stack pointer after pushing the return address.
+	 */
+	void Call(unsigned short returnAddress, unsigned char bank, unsigned short sp);
+
+	/* Pop the frames returned from (RET, RETI), frames whose return address was discarded by the game are dropped too.
+	 * @param sp Stack pointer before popping the return address.
+	 */
+	void Return(unsigned short sp);
+
+	/* Count M-Cycles towards the next sample.
+	 * @param cycles M-Cycles taken.
+	 * @return True if a sample is due.
+	 */
+	inline bool AddCycles(int cycles)
+	{
+		m_Cycles += cycles;
+		return m_Cycles >= m_Period;
+	}
+
+	/* Record the current call stack once per period elapsed.
+	 * @param pc Program counter.
+	 * @param bank ROM bank of the program counter.
+	 */
+	void Sample(unsigned short pc, unsigned char bank);
+
+private:
+	struct Frame
+	{
+		unsigned int location;
+		unsigned short sp;
+	};
+
+	// Locations are packed as (bank << 16) | address
+	std::map<unsigned int, std::string> m_Symbols;
+	std::vector<Frame> m_CallStack;
+	std::map<std::vector<unsigned int>, unsigned long long> m_Samples;
+
+	std::filesystem::path m_OutputPath;
+	int m_Period;
+	int m_Cycles;
+
+	/* Find the symbol an address belongs to (closest one before it in the same bank).
+	 * @param location Packed bank & address.
+	 * @return Packed location of the symbol, the same location if there's no symbol.
+	 */
+	unsigned int FindSymbol(unsigned int location);
+
+	/* Get the name used in the output for a location.
+	 * @param location Packed bank & address.
+	 * @return Symbol name or "BB:AAAA" if there's no symbol at that location.
+	 */
+	std::string GetName(unsigned int location);
+
+	/* Write the folded stacks to the output file.
+	 */
+	void Save();
+};
@@ -0,0 +1,157 @@
+#pragma once
+#include <vector>
+#include <initializer_list>
+#include <cstddef>
+
+/* Minimal x86-64 machine code writer for the recompiler, memory operands are always [base + disp32].
+ */
+class X86Emitter
+{
+public:
+	// 32-bit registers, the 64-bit ones share the same IDs
+	enum Register
+	{
+		EAX = 0,
+		ECX,
+		EDX,
+		EBX,
+		ESP,
+		EBP,
+		ESI,
+		EDI
+	};
+
+	std::vector<unsigned char> code;
+
+	inline void Bytes(std::initializer_list<unsigned char> bytes) { code.insert(code.end(), bytes); }
+
+	inline void Imm16(unsigned short value) { Bytes({(unsigned char)value, (unsigned char)(value >> 8)}); }
+
+	inline void Imm32(unsigned int value)
+	{
+		for (int i = 0; i < 4; i++) code.push_back((unsigned char)(value >> (i * 8)));
+	}
+
+	inline void Imm64(unsigned long long value)
+	{
+		for (int i = 0; i < 8; i++) code.push_back((unsigned char)(value >> (i * 8)));
+	}
+
+	/* ModRM for [base + disp32], base can't be ESP/R12.
+	 */
+	inline void Mem(int reg, int base, int disp)
+	{
+		code.push_back(0x80 | (reg << 3) | base);
+		Imm32(disp);
+	}
+
+	inline void MovzxByte(int reg, int base, int disp) { Bytes({0x0F, 0xB6}); Mem(reg, base, disp); }
+	inline void MovzxWord(int reg, int base, int disp) { Bytes({0x0F, 0xB7}); Mem(reg, base, disp); }
+	inline void StoreByte(int base, int disp, int reg) { Bytes({0x88}); Mem(reg, base, disp); }
+	inline void StoreWord(int base, int disp, int reg) { Bytes({0x66, 0x89}); Mem(reg, base, disp); }
+	inline void StoreByteImm(int base, int disp, unsigned char value) { Bytes({0xC6}); Mem(0, base, disp); code.push_back(value); }
+	inline void StoreWordImm(int base, int disp, unsigned short value) { Bytes({0x66, 0xC7}); Mem(0, base, disp); Imm16(value); }
+	inline void AddDwordImm(int base, int disp, unsigned int value) { Bytes({0x81}); Mem(0, base, disp); Imm32(value); }
+	inline void AddQwordImm(int base, int disp, unsigned int value) { Bytes({0x48, 0x81}); Mem(0, base, disp); Imm32(value); }
+	inline void IncDecWord(int base, int disp, bool decrement) { Bytes({0x66, 0xFF}); Mem(decrement ? 1 : 0, base, disp); }
+	inline void LoadDword(int reg, int base, int disp) { Bytes({0x8B}); Mem(reg, base, disp); }
+	inline void CompareDword(int reg, int base, int disp) { Bytes({0x3B}); Mem(reg, base, disp); }
+
+	/* Register to register ALU operation (dst = dst op src).
+	 * @param opcode 0x01 ADD, 0x29 SUB, 0x21 AND, 0x09 OR, 0x31 XOR, 0x89 MOV.
+	 */
+	inline void RegOp(unsigned char opcode, int dst, int src) { Bytes({opcode, (unsigned char)(0xC0 | (src << 3) | dst)}); }
+
+	/* Register & immediate ALU operation (dst = dst op imm32).
+	 * @param op 0 ADD, 4 AND, 6 XOR, 1 OR.
+	 */
+	inline void RegOpImm(int op, int dst, unsigned int value) { Bytes({0x81, (unsigned char)(0xC0 | (op << 3) | dst)}); Imm32(value); }
+
+	inline void MovImm(int reg, unsigned int value) { code.push_back(0xB8 + reg); Imm32(value); }
+
+	/* Jump (0xE9) or conditional jump (0x0F 0x8x) with a 32-bit displacement patched later.
+	 * @param condition 0 for an unconditional jump, 0x85 JNE, 0x8D JGE.
+	 * @return Position of the displacement.
+	 */
+	inline std::size_t Jump(unsigned char condition)
+	{
+		if (condition == 0) code.push_back(0xE9);
+		else Bytes({0x0F, condition});
+
+		Imm32(0);
+		return code.size() - 4;
+	}
+
+	/* Point a jump at a position in the code.
+	 * @param displacement Position returned by Jump.
+	 * @param target Position to jump to.
+	 */
+	inline void Patch(std::size_t displacement, std::size_t target)
+	{
+		unsigned int offset = (unsigned int)(target - (displacement + 4));
+		for (int i = 0; i < 4; i++) code[displacement + i] = (unsigned char)(offset >> (i * 8));
+	}
+
+	/* Call a function through RAX, the arguments have to be set beforehand.
+	 */
+	inline void Call(const void *function)
+	{
+		Bytes({0x48, 0xB8});
+		Imm64((unsigned long long)function);
+		Bytes({0xFF, 0xD0});
+	}
+};
+
+/* Executable memory & statistics of the x86-64 recompiler (BITDMG_JIT), native blocks are bump allocated and only freed all at once.
+ */
+class Jit
+{
+public:
+	/* @param size Bytes of executable memory to reserve.
+	 */
+	Jit(std::size_t size = 16 << 20);
+
+	/* Free the executable memory & log the statistics.
+	 */
+	~Jit();
+
+	/* Check that the executable memory could be mapped.
+	 * @return True if blocks can be compiled.
+	 */
+	inline bool IsValid() { return m_Memory != nullptr; }
+
+	/* Copy native code to executable memory.
+	 * @param code Machine code.
+	 * @return Start of the copy, nullptr if the memory is full.
+	 */
+	void *Add(const std::vector<unsigned char> &code);
+
+	/* Drop every native block, the caller must not be running any of them.
+	 */
+	void Reset();
+
+	/* Compare every natively run opcode with the interpreter.
+	 * @param verify True to verify.
+	 */
+	inline void SetVerify(bool verify) { m_Verify = verify; }
+	inline bool IsVerifying() { return m_Verify; }
+
+	/* Count a verified opcode.
+	 * @param match True if the native code matched the interpreter.
+	 */
+	inline void CountVerified(bool match)
+	{
+		m_Verified++;
+		if (!match) m_Mismatches++;
+	}
+
+private:
+	unsigned char *m_Memory;
+	std::size_t m_Size;
+	std::size_t m_Used;
+
+	bool m_Verify;
+	unsigned long long m_Compiled;
+	unsigned long long m_Verified;
+	unsigned long long m_Mismatches;
+};
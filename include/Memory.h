@@ -1,6 +1,7 @@
 #pragma once
 #include <array>
 #include <memory>
+#include <functional>
 
 #include "Cartridge.h"
 
@@ -113,13 +114,27 @@ enum IO
 class Memory
 {
 public:
+	// Granularity of the tracking of RAM holding pre-decoded code
+	static constexpr int CODE_PAGE_SIZE = 128;
+	static constexpr int CODE_PAGES = 0x10000 / CODE_PAGE_SIZE;
+
+	// Granularity of the page tables of ReadU8 & WriteU8
+	static constexpr int MEMORY_PAGE_SIZE = 256;
+	static constexpr int MEMORY_PAGES = 0x10000 / MEMORY_PAGE_SIZE;
+
 	Memory(std::shared_ptr<Cartridge> cart);
 
-	/* Get 8-bit value.
+	/* Get 8-bit value, pages without side effects (ROM, WRAM & its Echo RAM alias) are read straight from the page table.
 	 *  @param address Memory address to read.
 	 * @return Value at address.
 	 */
-	unsigned char ReadU8(unsigned short address);
+	inline unsigned char ReadU8(unsigned short address)
+	{
+		const unsigned char *page = m_ReadPages[address / MEMORY_PAGE_SIZE];
+		if (page != nullptr) return page[address % MEMORY_PAGE_SIZE];
+
+		return ReadU8Slow(address);
+	}
 
 	/* Get 8-bit value without considering Gameboy state.
 	 *  @param address Memory address to read.
@@ -131,7 +146,18 @@ public:
 	 * @param address Memory address to write.
 	 *  @param value Value to write.
 	 */
-	void WriteU8(unsigned short address, unsigned char value);
+	inline void WriteU8(unsigned short address, unsigned char value)
+	{
+		// Only WRAM & Echo RAM pages without pre-decoded code are in the table
+		unsigned char *page = m_WritePages[address / MEMORY_PAGE_SIZE];
+		if (page != nullptr)
+		{
+			page[address % MEMORY_PAGE_SIZE] = value;
+			return;
+		}
+
+		WriteU8Slow(address, value);
+	}
 
 	/* Write 8-bit value without considering Gameboy state.
 	 * @param address Memory address to write.
@@ -170,6 +196,31 @@ public:
 	 */
 	void WriteU16Stack(unsigned short address, unsigned short value);
 
+	/* Check if a 16-bit stack access can skip the checks of ReadU16 & WriteU16Stack, both bytes have to be in WRAM or HRAM where no lock, register or mapper applies.
+	 * @param address Memory address of the lower byte.
+	 * @return True if the stack can be read & written directly.
+	 */
+	static inline bool IsDirectStack(unsigned short address) { return (address >= 0xC000 && address <= 0xDFFE) || (address >= 0xFF80 && address <= 0xFFFD); }
+
+	/* Read 16-bit value from a stack in WRAM or HRAM (see IsDirectStack).
+	 * @param address Memory address of the lower byte.
+	 * @return Value read.
+	 */
+	inline unsigned short ReadStackDirect(unsigned short address) { return ((unsigned short)m_Memory[address + 1] << 8) | m_Memory[address]; }
+
+	/* Write 16-bit value to a stack in WRAM or HRAM (see IsDirectStack), with the code page checks of WriteU16Stack.
+	 * @param address Memory address of the lower byte.
+	 * @param value Value to write.
+	 */
+	inline void WriteStackDirect(unsigned short address, unsigned short value)
+	{
+		m_Memory[address] = (unsigned char)value;
+		m_Memory[address + 1] = (unsigned char)(value >> 8);
+
+		CheckCodeWrite(address);
+		CheckCodeWrite(address + 1);
+	}
+
 	/* Lock VRAM writes.
 	 */
 	void LockVRAM();
@@ -191,13 +242,121 @@ public:
 	*/
 	void RequestInterrupt(InterruptType interrupt);
 
+	/* Check if any interrupt is both requested and enabled (IE & IF != 0), kept up to date on writes to IE & IF.
+	 * @return True if an interrupt is pending.
+	 */
+	inline bool IsInterruptPending() { return m_InterruptPending; }
+
+	/* Get the cartridge ROM bank mapped at 0x4000-0x7FFF.
+	 * @return Current ROM bank.
+	 */
+	inline unsigned char GetRomBank() { return m_Cartridge->GetRomBank(); }
+
+	/* Get the 16KiB of cartridge ROM mapped at an address, reads from it skip the mapper (see Cartridge::GetRomRegion).
+	 * @param address Memory address in 0x0000-0x7FFF.
+	 * @return Start of the mapped region, nullptr if it can't be read directly.
+	 */
+	inline const unsigned char *GetRomRegion(unsigned short address) { return m_Cartridge->GetRomRegion(address); }
+
 	/* Update the joypad register ($FF00 - P1) with data from m_InputBuffer.
 	 */
 	void UpdateInputState(bool buffer[8]);
 
+	/* Set the function that advances the PPU & timers, called before the CPU accesses VRAM, OAM or IO registers.
+	 * @param handler Function receiving the M-Cycles the CPU ran since the last call.
+	 */
+	void SetSyncHandler(std::function<void(int)> handler);
+
+	/* Add M-Cycles run by the CPU without advancing the PPU & timers.
+	 * @param cycles M-Cycles taken by the last opcode.
+	 */
+	inline void AddPendingCycles(int cycles) { m_PendingCycles += cycles; }
+
+	/* Advance the PPU & timers by the pending M-Cycles.
+	 */
+	void Sync();
+
+	/* Check (and clear) if the CPU wrote to a register that moves the next PPU/timer event (LCDC, TIMA, TMA, TAC).
+	 * @return True if the next event has to be recalculated.
+	 */
+	bool TakeScheduleChange();
+
+	/* Set the function called when the CPU writes to a page holding pre-decoded code or to the mapper registers (ROM bank switch).
+	 * @param handler Function receiving the address written.
+	 */
+	void SetCodeWriteHandler(std::function<void(unsigned short)> handler);
+
+	/* Mark if a page holds pre-decoded code, writes to it are reported to the code write handler.
+	 * @param address Any address in the page.
+	 * @param hasCode True if the page holds code.
+	 */
+	inline void SetCodePage(unsigned short address, bool hasCode)
+	{
+		m_CodePages[address / CODE_PAGE_SIZE] = hasCode;
+		UpdateWritePage(address);
+	}
+
+	/* Get how many times the CPU wrote to the IO registers (0xFF00-0xFF7F), the watchdog takes them as a sign of progress.
+	 * @return IO register writes since the emulator started.
+	 */
+	inline unsigned long long GetIOWriteCount() { return m_IOWrites; }
+
 private:
 	std::array<unsigned char, 0x10000> m_Memory;
 
+	// Backing store of every page that can be accessed directly, nullptr for pages going through ReadU8Slow & WriteU8Slow
+	// (IO & HRAM, VRAM & OAM which need the PPU in sync for their locks, cartridge RAM & mapper registers, RAM holding code)
+	std::array<const unsigned char *, MEMORY_PAGES> m_ReadPages;
+	std::array<unsigned char *, MEMORY_PAGES> m_WritePages;
+
+	/* Read a byte from a page with side effects.
+	 * @param address Memory address to read.
+	 * @return Value at address.
+	 */
+	unsigned char ReadU8Slow(unsigned short address);
+
+	/* Write a byte to a page with side effects.
+	 * @param address Memory address to write.
+	 * @param value Value to write.
+	 */
+	void WriteU8Slow(unsigned short address, unsigned char value);
+
+	/* Side effects of the CPU reading & writing an address of the IO/HRAM page (0xFF00-0xFFFF).
+	 */
+	struct IORegister
+	{
+		unsigned char (Memory::*read)(unsigned short address);
+		void (Memory::*write)(unsigned short address, unsigned char value);
+	};
+
+	// Dispatch table of the IO/HRAM page indexed by the low byte of the address, generated at compile time.
+	// Registers without side effects are plain loads & stores, HRAM & IE are handled before the table is reached.
+	static const std::array<IORegister, 256> s_IOTable;
+
+	/* Assign the registers with side effects their handlers.
+	 * @return Table indexed by the low byte of the address.
+	 */
+	static constexpr std::array<IORegister, 256> BuildIOTable();
+
+	// IO/HRAM page handlers, called by ReadU8Slow & WriteU8Slow once the PPU & timers are in sync
+	unsigned char ReadPlain(unsigned short address);
+	unsigned char ReadJoypad(unsigned short address);
+	unsigned char ReadSerial(unsigned short address);
+	void WritePlain(unsigned short address, unsigned char value);
+	void WriteDivider(unsigned short address, unsigned char value);
+	void WriteDMA(unsigned short address, unsigned char value);
+	void WriteInterrupt(unsigned short address, unsigned char value);
+	void WriteSchedule(unsigned short address, unsigned char value);
+
+	/* Point the ROM pages at the banks currently mapped, called after every mapper write.
+	 */
+	void UpdateRomPages();
+
+	/* Add or remove a WRAM page & its Echo RAM alias from the write table depending on whether the page holds pre-decoded code.
+	 * @param address Any address in the WRAM page, other addresses are ignored.
+	 */
+	void UpdateWritePage(unsigned short address);
+
 	std::shared_ptr<Cartridge> m_Cartridge;
 
 	bool m_InputBuffer[8];
@@ -206,4 +365,43 @@ private:
 
 	bool m_VramLocked;
 	bool m_OamLocked;
+	bool m_InterruptPending;
+
+	/* Recalculate the cached pending interrupt state if IE or IF were written.
+	 * @param address Memory address written.
+	 */
+	inline void CheckInterruptWrite(unsigned short address)
+	{
+		if (address == IO::IF || address == IO::IE) m_InterruptPending = (m_Memory[IO::IE] & m_Memory[IO::IF]) != 0;
+	}
+
+	std::array<bool, CODE_PAGES> m_CodePages;
+	std::function<void(unsigned short)> m_CodeWriteHandler;
+
+	/* Report writes to pages holding pre-decoded code, code never runs from Echo RAM (see CPU::DecodeBlock).
+	 * @param address Memory address written, in WRAM for writes to Echo RAM (see ResolveEcho).
+	 */
+	inline void CheckCodeWrite(unsigned short address)
+	{
+		if (m_CodePages[address / CODE_PAGE_SIZE]) m_CodeWriteHandler(address);
+	}
+
+	/* Resolve Echo RAM (0xE000-0xFDFF) to the WRAM byte it aliases, its own bytes of m_Memory are never used.
+	 * @param address Memory address.
+	 * @return Address in m_Memory.
+	 */
+	static inline unsigned short ResolveEcho(unsigned short address) { return (address >= 0xE000 && address <= 0xFDFF) ? address - 0x2000 : address; }
+
+	std::function<void(int)> m_SyncHandler;
+	int m_PendingCycles;
+	bool m_ScheduleChanged;
+	unsigned long long m_IOWrites;
+
+	/* Bring the PPU & timers up to date if the CPU is about to access memory they own.
+	 * @param address Memory address accessed by the CPU.
+	 */
+	inline void SyncAccess(unsigned short address)
+	{
+		if (m_PendingCycles != 0 && ((address >= 0x8000 && address <= 0x9FFF) || (address >= 0xFE00 && address <= 0xFF7F))) Sync();
+	}
 };
\ No newline at end of file
@@ -0,0 +1,39 @@
+#pragma once
+#include <array>
+
+/* Count executions & M-Cycles of every opcode, disabled version that compiles to nothing.
+ */
+template <bool Enabled>
+class OpcodeProfiler
+{
+public:
+	inline void Record(int, int) {}
+};
+
+/* Count executions & M-Cycles of every opcode (0x000-0x0FF main, 0x100-0x1FF 0xCB prefixed), printed when destroyed.
+ */
+template <>
+class OpcodeProfiler<true>
+{
+public:
+	OpcodeProfiler();
+	~OpcodeProfiler();
+
+	/* Count an executed opcode.
+	 * @param opcode Main opcode, or 0x100 + the byte following the 0xCB prefix.
+	 * @param cycles M-Cycles taken by the opcode.
+	 */
+	inline void Record(int opcode, int cycles)
+	{
+		m_Count[opcode]++;
+		m_Cycles[opcode] += cycles;
+	}
+
+	/* Log a histogram of the executed opcodes sorted by the M-Cycles spent on them.
+	 */
+	void Print();
+
+private:
+	std::array<unsigned long long, 512> m_Count;
+	std::array<unsigned long long, 512> m_Cycles;
+};
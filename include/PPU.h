@@ -14,6 +14,11 @@ public:
 	 */
 	void Tick(int cycles);
 
+	/* Get how long until the PPU switches modes or increments LY, which is when it might request an interrupt.
+	 * @return T-Cycles until the next event, INT_MAX if the PPU is disabled.
+	 */
+	int GetCyclesUntilNextEvent();
+
 	/* Print tiles to console using characters: " , ░, ▓, █".
 	 */
 	void PrintTiles();
@@ -0,0 +1,123 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <filesystem>
+#include <unordered_map>
+
+#include "Cartridge.h"
+
+// Interface between the emulator & the generated code, written as is at the top of every generated file.
+// Cached modules are keyed on a hash of their source, BITDMG_RECOMPILED_ABI only guards against loading a module built by hand for another interface.
+#define BITDMG_RECOMPILED_ABI 1
+#define BITDMG_RECOMPILED_INTERFACE                                                                                 \
+	struct RecompiledState                                                                                          \
+	{                                                                                                               \
+		unsigned char *r8;		 /* Registers::r8 */                                                                  \
+		unsigned short *r16;	 /* Registers::r16 */                                                                 \
+		unsigned short *sp;                                                                                         \
+		unsigned short *pc;                                                                                         \
+		unsigned short *flagResult; /* FlagRegister */                                                              \
+		unsigned char *flagOperands;                                                                                \
+		bool *flagSubtract;                                                                                         \
+		unsigned long long *instructionCount;                                                                       \
+		int budget;                                                                                                 \
+		int elapsed;                                                                                                \
+		int pending;                                                                                                \
+		int (*execute)(RecompiledState *state, int index); /* Run an opcode through its handler, 0 to keep going */ \
+		void *cpu;                                                                                                  \
+		void *block;                                                                                                \
+	};                                                                                                              \
+	typedef int (*RecompiledFunction)(RecompiledState *state);                                                      \
+	struct RecompiledBlock                                                                                          \
+	{                                                                                                               \
+		unsigned int key; /* (bank << 16) | address */                                                              \
+		unsigned short end;                                                                                         \
+		unsigned short opcodeCount;                                                                                 \
+		RecompiledFunction function;                                                                                \
+	};
+
+BITDMG_RECOMPILED_INTERFACE
+
+#define BITDMG_STRINGIFY_EXPANDED(x) #x
+#define BITDMG_STRINGIFY(x) BITDMG_STRINGIFY_EXPANDED(x)
+
+/* Shared library of ROM code translated to C++ ahead of time (see CPU::Recompile), cached per ROM checksum & hash of the generated source.
+ */
+class RecompiledModule
+{
+public:
+	// Source of the interface for the generated code
+	static constexpr const char *INTERFACE_SOURCE = BITDMG_STRINGIFY(BITDMG_RECOMPILED_INTERFACE);
+
+	/* Load a module & index its blocks.
+	 * @param libraryPath Shared library built by Build.
+	 */
+	RecompiledModule(std::filesystem::path libraryPath);
+
+	/* Unload the module, nothing may run its code afterwards.
+	 */
+	~RecompiledModule();
+
+	/* Check that the module could be loaded & matches this build of the emulator.
+	 * @return True if the module is usable.
+	 */
+	inline bool IsValid() { return m_Handle != nullptr; }
+
+	/* Find the translation of a block.
+	 * @param key (bank << 16) | address of the first opcode.
+	 * @param end First address after the block, must match the decoded block.
+	 * @param opcodeCount Opcodes in the block, must match the decoded block.
+	 * @return Function running the block, nullptr if it wasn't translated.
+	 */
+	RecompiledFunction Find(unsigned int key, unsigned short end, size_t opcodeCount);
+
+	/* Translate a ROM & build it into the cache directory (the offline part, see --recompile).
+	 * @param cartridge ROM to translate.
+	 * @return True if the shared library was built.
+	 */
+	static bool Create(Cartridge &cartridge);
+
+	/* Load the cached module of a ROM, building it first if it's missing or the translator now generates something else.
+	 * @param cartridge Running ROM.
+	 * @return Module, nullptr if it couldn't be built or loaded.
+	 */
+	static std::shared_ptr<RecompiledModule> Load(Cartridge &cartridge);
+
+	/* Get the cached source or library of a ROM.
+	 * @param checksum ROM checksum.
+	 * @param sourceHash Hash of the generated source (see HashSource).
+	 * @param extension ".cpp" or the shared library extension.
+	 * @return Path in the cache directory.
+	 */
+	static std::filesystem::path GetCachePath(unsigned int checksum, unsigned long long sourceHash, std::string extension);
+
+	/* Hash generated code, any change to the translator or the interface changes the cached module's name.
+	 * @param source Output of CPU::Recompile.
+	 * @return 64-bit FNV-1a hash.
+	 */
+	static unsigned long long HashSource(const std::string &source);
+
+	/* Compile generated code into a shared library with the system compiler ($CXX, c++ by default).
+	 * @param sourcePath Generated C++ file.
+	 * @param libraryPath Output shared library.
+	 * @return True if the compiler succeeded.
+	 */
+	static bool Build(std::filesystem::path sourcePath, std::filesystem::path libraryPath);
+
+	// Directory holding the translated ROMs
+	static constexpr const char *CACHE_DIRECTORY = "recompiled";
+
+	// Shared library extension
+	static constexpr const char *LIBRARY_EXTENSION = ".so";
+
+private:
+	void *m_Handle;
+	std::unordered_map<unsigned int, const RecompiledBlock *> m_Blocks;
+
+	/* Write generated code to the cache directory & build it.
+	 * @param cartridge Translated ROM.
+	 * @param source Output of CPU::Recompile.
+	 * @return True if the shared library was built.
+	 */
+	static bool Create(Cartridge &cartridge, const std::string &source);
+};
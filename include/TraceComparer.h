@@ -0,0 +1,77 @@
+#pragma once
+#include <array>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <filesystem>
+
+#include "Tracer.h"
+
+/* Compare the CPU state against a reference trace while the emulator runs, the reference is streamed so memory use stays constant.
+ * Reads gameboy-doctor text logs and BitDMG binary traces (see Tracer), the cycle stamps of binary traces aren't compared.
+ */
+class TraceComparer
+{
+public:
+	/* Open a reference trace, binary traces are recognised by their magic.
+	 * @param referencePath Reference trace file.
+	 */
+	TraceComparer(std::filesystem::path referencePath);
+
+	/* Log how many instructions matched if the comparison didn't finish.
+	 */
+	~TraceComparer();
+
+	/* Check that the reference trace could be opened.
+	 * @return True if the comparer is usable.
+	 */
+	inline bool IsValid() { return m_IsValid; }
+
+	/* Compare the state before an opcode with the next reference record, logs the surrounding records on the first mismatch.
+	 * @param record CPU state.
+	 */
+	void Compare(const TraceRecord &record);
+
+	/* Check if the comparison is over (mismatch found or end of the reference trace).
+	 * @return True if the emulator should stop.
+	 */
+	inline bool IsFinished() { return m_Finished; }
+
+private:
+	// Records logged before & after a mismatch
+	static constexpr size_t WINDOW_SIZE = 8;
+
+	std::ifstream m_File;
+	bool m_IsBinary;
+	bool m_IsValid;
+	bool m_Finished;
+
+	// Binary records are read in chunks
+	std::vector<TraceRecord> m_Chunk;
+	size_t m_ChunkSize;
+	size_t m_ChunkPosition;
+	std::string m_Line;
+
+	// Last matching records, indexed by instruction count
+	std::array<TraceRecord, WINDOW_SIZE> m_History;
+	unsigned long long m_Count;
+
+	/* Read the next reference record.
+	 * @param record Output record.
+	 * @return False at the end of the reference trace or on a malformed line.
+	 */
+	bool ReadReference(TraceRecord &record);
+
+	/* Parse a gameboy-doctor log line ("A:01 F:B0 ... PCMEM:00,C3,60,01").
+	 * @param line Text line.
+	 * @param record Output record.
+	 * @return True if the line has the expected format.
+	 */
+	static bool ParseLine(const std::string &line, TraceRecord &record);
+
+	/* Log the records around a mismatch.
+	 * @param expected Reference record.
+	 * @param actual Emulator record.
+	 */
+	void LogMismatch(const TraceRecord &expected, const TraceRecord &actual);
+};
@@ -0,0 +1,82 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <fstream>
+#include <filesystem>
+
+// CPU state before an opcode runs, stored in host byte order.
+struct TraceRecord
+{
+	unsigned long long cycle; // M-Cycles since the trace started
+	unsigned short sp;
+	unsigned short pc;
+	unsigned char a, f, b, c, d, e, h, l;
+	unsigned char pcmem[4]; // Bytes at PC to PC + 3
+};
+
+static_assert(sizeof(TraceRecord) == 24, "TraceRecord is written to disk as is");
+
+/* Binary instruction trace, records are queued in a lock-free ring buffer and written to disk by a background thread.
+ */
+class Tracer
+{
+public:
+	/* Start tracing to a file.
+	 * @param tracePath Binary trace file to write.
+	 */
+	Tracer(std::filesystem::path tracePath);
+
+	/* Write the remaining records and close the file.
+	 */
+	~Tracer();
+
+	/* Check that the trace file could be created.
+	 * @return True if the tracer is writing.
+	 */
+	inline bool IsValid() { return m_IsValid; }
+
+	/* Queue a record, waits for the writer if the buffer is full.
+	 * @param record CPU state, the cycle stamp is filled in by the tracer.
+	 */
+	void Push(TraceRecord record);
+
+	/* Count M-Cycles for the next record's stamp.
+	 * @param cycles M-Cycles taken.
+	 */
+	inline void AddCycles(int cycles) { m_Cycle += cycles; }
+
+	/* Format a record as a gameboy-doctor log line (without line break).
+	 * @param record Record to format.
+	 * @param buffer Output, at least 96 characters.
+	 */
+	static void FormatRecord(const TraceRecord &record, char *buffer);
+
+	/* Convert a binary trace to a gameboy-doctor compatible text log.
+	 * @param tracePath Binary trace file.
+	 * @param logPath Text log to write.
+	 * @return True if the trace was converted.
+	 */
+	static bool ConvertToText(std::filesystem::path tracePath, std::filesystem::path logPath);
+
+	// Written at the start of every binary trace
+	static constexpr char MAGIC[8] = {'B', 'D', 'M', 'G', 'T', 'R', 'C', '1'};
+
+private:
+	// Power of two so positions can wrap with a mask
+	static constexpr size_t BUFFER_SIZE = 1 << 16;
+
+	std::vector<TraceRecord> m_Buffer;
+	std::atomic<size_t> m_Head; // Next record to push, only written by the emulator
+	std::atomic<size_t> m_Tail; // Next record to write, only written by the writer thread
+	std::atomic<bool> m_Running;
+
+	std::ofstream m_File;
+	std::thread m_Writer;
+	unsigned long long m_Cycle;
+	bool m_IsValid;
+
+	/* Writer thread, flushes the buffer to disk until the tracer stops.
+	 */
+	void WriteLoop();
+};
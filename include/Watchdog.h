@@ -0,0 +1,67 @@
+#pragma once
+
+// Why the watchdog stopped the emulator, also used as the process exit code
+enum class HangReason : int
+{
+	None = 0,
+	TightLoop = 2,	   // PC stuck in a few bytes with interrupts disabled & no IO writes
+	HaltedForever = 3, // HALT with no interrupt enabled in IE, nothing can wake the CPU
+	LockedUp = 4,	   // Invalid opcode, the CPU stopped (CPU::RunUntil returned -1)
+};
+
+/* Detects emulated code that can't make progress anymore so unattended runs end right away instead of at their timeout.
+ * PC is sampled every time the CPU returns to the scheduler (every PPU/timer event) and the state is checked at the end of every frame.
+ */
+class Watchdog
+{
+public:
+	Watchdog();
+
+	/* Record where the CPU is, called after every CPU run.
+	 * @param pc Program counter.
+	 * @param ime True if interrupts are enabled.
+	 */
+	inline void Sample(unsigned short pc, bool ime)
+	{
+		if (pc < m_MinPC) m_MinPC = pc;
+		if (pc > m_MaxPC) m_MaxPC = pc;
+		m_IMESeen |= ime;
+	}
+
+	/* Check the state at the end of a frame.
+	 * @param halted True if the CPU is halted.
+	 * @param ie Interrupt enable register.
+	 * @param ioWrites Writes to the IO registers since the emulator started (see Memory::GetIOWriteCount).
+	 * @return Why the emulated code hung, HangReason::None if it may still make progress.
+	 */
+	HangReason CheckFrame(bool halted, unsigned char ie, unsigned long long ioWrites);
+
+	/* Get the lowest & highest PC of the current window, for the state dump.
+	 * @return (lowest << 16) | highest.
+	 */
+	inline unsigned int GetRange() { return (m_MinPC << 16) | m_MaxPC; }
+
+	/* Get the name of a reason, for the state dump.
+	 * @param reason Hang reason.
+	 * @return Lower case name.
+	 */
+	static const char *GetReasonName(HangReason reason);
+
+	// Frames (~1 second) the CPU has to stay in the loop before it's reported, longer than any delay loop run with interrupts disabled
+	static constexpr int WINDOW_FRAMES = 60;
+
+	// Widest loop considered tight, JR -2 is 2 bytes & a polling loop on RAM around 8
+	static constexpr int LOOP_BYTES = 16;
+
+private:
+	unsigned short m_MinPC;
+	unsigned short m_MaxPC;
+	bool m_IMESeen;
+	unsigned long long m_IOWrites;
+	int m_Frames;
+
+	/* Start a new window.
+	 * @param ioWrites IO writes so far.
+	 */
+	void Reset(unsigned long long ioWrites);
+};
@@ -2,11 +2,14 @@
 #include "Log.h"
 #include "Utils.h"
 
+#include <algorithm>
 #include <iostream>
-#include <sstream>
 #include <iomanip>
+#include <sstream>
 
-CPU::CPU(std::shared_ptr<Memory> memory) : m_SP(0xFFFE), m_PC(0x0100), m_Halted(false), m_HaltBug(false)
+CPU::CPU(std::shared_ptr<Memory> memory) : m_SP(0xFFFE), m_PC(0x0100), m_Halted(false), m_HaltBug(false),
+									   m_JumpedBack(false), m_IdleLoop(false), m_LoopEnd(0), m_RejectedLoop(0xFFFF), m_InstructionCount(0), m_SkippedCycles(0),
+									   m_Operands(nullptr), m_CodeChanged(false), m_JitVerify(false)
 {
 	// Mimic state after boot ROM
 	m_Registers.a = 0x01;
@@ -17,9 +20,10 @@ CPU::CPU(std::shared_ptr<Memory> memory) : m_SP(0xFFFE), m_PC(0x0100), m_Halted(
 	m_Registers.h = 0x01;
 	m_Registers.l = 0x4D;
 
-	m_FlagRegister.zero = true;
-	m_FlagRegister.halfCarry = true;
-	m_FlagRegister.carry = true;
+	m_FlagRegister.set(true, false, true, true);
+
+	m_BlockLookup.fill({0xFFFFFFFF, nullptr});
+	m_CodeWindows.fill(nullptr);
 
 	m_IME = false;
 	m_EnableIME = false;
@@ -33,16 +37,16 @@ int CPU::Cycle()
 
 	if (CheckInterrupts() == 5) cycles = 5;
 
-	if (m_Halted) 
+	if (m_Halted)
+	{
+		Instrument(1);
 		return 1;
+	}
 
-	unsigned char opcode = m_Mem->ReadU8(m_PC++);
+	TraceOpcode();
+	if (m_Coverage) m_Coverage->Mark(m_PC, GetBank(m_PC));
 
-	if (!IsValidOpcode(opcode))
-	{
-		m_PC--;
-		return false;
-	}
+	unsigned char opcode = ReadCode(m_PC++);
 
 	if (m_HaltBug) // Hardware bug where the byte at PC is read twice
 	{
@@ -50,184 +54,1041 @@ int CPU::Cycle()
 		m_HaltBug = false;
 	}
 
+	unsigned short operandAddress = m_PC;
+
+	const OpcodeEntry &entry = s_OpcodeTable[opcode];
+	cycles = (this->*entry.handler)(entry.x, entry.y);
+	if (cycles == -1) return -1;
+	m_InstructionCount++;
+
+	// 0xCB prefixed opcodes are counted by the byte following the prefix
+	if constexpr (PROFILE_OPCODES) m_Profiler.Record(opcode == 0xCB ? 0x100 | m_Mem->ReadU8Unfiltered(operandAddress) : opcode, cycles);
+
+	// Enable interrupts after the instruction (used by the EI instruction)
+	if (m_EnableIME && opcode != 0xFB)
+	{
+		m_IME = true;
+		m_EnableIME = false;
+	}
+
+	Instrument(cycles);
+	return cycles;
+}
+
+constexpr std::array<CPU::OpcodeEntry, 256> CPU::BuildOpcodeTable()
+{
 	// Opcode decoding, method described by Scott Mansell in the website below
 	// https://archive.gbdev.io/salvage/decoding_gbz80_opcodes/Decoding%20Gamboy%20Z80%20Opcodes.html
 	// and using the reference table described in the pandocs
 	// https://gbdev.io/pandocs/CPU_Instruction_Set.html
 
-	unsigned char block = opcode >> 6;
-	unsigned char y = (opcode & 0b00111000) >> 3;
-	unsigned char z = opcode & 0b00000111;
-
-	unsigned char p = (opcode & 0b00110000) >> 4;
-	bool q = (opcode & 0b00001000) >> 3;
+	std::array<OpcodeEntry, 256> table{};
 
-	if (opcode == 0xCB)
+	for (int i = 0; i < 256; i++)
 	{
-		opcode = m_Mem->ReadU8(m_PC++);
+		unsigned char opcode = i;
 
-		// Recalculate sections
-		block = opcode >> 6;
-		y = (opcode & 0b00111000) >> 3;
-		z = opcode & 0b00000111;
+		unsigned char block = opcode >> 6;
+		unsigned char y = (opcode & 0b00111000) >> 3;
+		unsigned char z = opcode & 0b00000111;
+
+		unsigned char p = (opcode & 0b00110000) >> 4;
+		bool q = (opcode & 0b00001000) >> 3;
+
+		OpcodeEntry &entry = table[i];
+		entry = {&CPU::InvalidOpcode, 0, 0};
 
 		if (block == 0)
 		{
-			if (y == 0) cycles = RLC_r8(z);
-			else if (y == 1) cycles = RRC_r8(z);
-			else if (y == 2) cycles = RL_r8(z);
-			else if (y == 3) cycles = RR_r8(z);
-			else if (y == 4) cycles = SLA_r8(z);
-			else if (y == 5) cycles = SRA_r8(z);
-			else if (y == 6) cycles = SWAP_r8(z);
-			else if (y == 7) cycles = SRL_r8(z);
-			else return UninplementedOpcode(opcode);
+			if (z == 0)
+			{
+				if (y == 0) entry = {&CPU::OpNoArgs<&CPU::NOP>, 0, 0};
+				else if (y == 1) entry = {&CPU::OpNoArgs<&CPU::LD_imm16_SP>, 0, 0};
+				else if (y == 2) entry = {&CPU::OpNoArgs<&CPU::STOP>, 0, 0};
+				else if (y == 3) entry = {&CPU::OpNoArgs<&CPU::JR_s8>, 0, 0};
+				else entry = {&CPU::OpOneArg<&CPU::JR_C>, (unsigned char)(y - 4), 0};
+			}
+			else if (z == 1)
+			{
+				if (q == 0) entry = {&CPU::OpOneArg<&CPU::LD_r16_imm16>, p, 0};
+				else entry = {&CPU::OpOneArg<&CPU::ADD_HL_r16>, p, 0};
+			}
+			else if (z == 2)
+			{
+				if (q == 0) entry = {&CPU::OpOneArg<&CPU::LD_r16_a>, p, 0};
+				else entry = {&CPU::OpOneArg<&CPU::LD_a_r16>, p, 0};
+			}
+			else if (z == 3)
+			{
+				if (q == 0) entry = {&CPU::OpOneArg<&CPU::INC_r16>, p, 0};
+				else entry = {&CPU::OpOneArg<&CPU::DEC_r16>, p, 0};
+			}
+			else if (z == 4) entry = {&CPU::OpOneArg<&CPU::INC_r8>, y, 0};
+			else if (z == 5) entry = {&CPU::OpOneArg<&CPU::DEC_r8>, y, 0};
+			else if (z == 6) entry = {&CPU::OpOneArg<&CPU::LD_r8_imm8>, y, 0};
+			else if (z == 7)
+			{
+				if (y == 0) entry = {&CPU::OpNoArgs<&CPU::RLCA>, 0, 0};
+				else if (y == 1) entry = {&CPU::OpNoArgs<&CPU::RRCA>, 0, 0};
+				else if (y == 2) entry = {&CPU::OpNoArgs<&CPU::RLA>, 0, 0};
+				else if (y == 3) entry = {&CPU::OpNoArgs<&CPU::RRA>, 0, 0};
+				else if (y == 4) entry = {&CPU::OpNoArgs<&CPU::DAA>, 0, 0};
+				else if (y == 5) entry = {&CPU::OpNoArgs<&CPU::CPL>, 0, 0};
+				else if (y == 6) entry = {&CPU::OpNoArgs<&CPU::SCF>, 0, 0};
+				else entry = {&CPU::OpNoArgs<&CPU::CCF>, 0, 0};
+			}
+		}
+		else if (block == 1)
+		{
+			if (opcode == 0x76) entry = {&CPU::OpNoArgs<&CPU::HALT>, 0, 0};
+			else entry = {&CPU::LD_r8_r8, y, z};
 		}
-		else if (block == 1) cycles = BIT(y, z);
-		else if (block == 2) cycles = RES(y, z);
-		else if (block == 3) cycles = SET(y, z);
-		else return UninplementedOpcode(opcode);
-	}
-	else if (block == 0)
-	{
-		if (z == 0)
+		else if (block == 2)
 		{
-			if (y == 0) cycles = NOP();
-			else if (y == 1) cycles = LD_imm16_SP();
-			else if (y == 2) cycles = STOP();
-			else if (y == 3) cycles = JR_s8();
-			else cycles = JR_C(y - 4);
+			if (y == 0) entry = {&CPU::OpOneArg<&CPU::ADD_a_r8>, z, 0};
+			else if (y == 1) entry = {&CPU::OpOneArg<&CPU::ADC_a_r8>, z, 0};
+			else if (y == 2) entry = {&CPU::OpOneArg<&CPU::SUB_a_r8>, z, 0};
+			else if (y == 3) entry = {&CPU::OpOneArg<&CPU::SBC_a_r8>, z, 0};
+			else if (y == 4) entry = {&CPU::OpOneArg<&CPU::AND_a_r8>, z, 0};
+			else if (y == 5) entry = {&CPU::OpOneArg<&CPU::XOR_a_r8>, z, 0};
+			else if (y == 6) entry = {&CPU::OpOneArg<&CPU::OR_a_r8>, z, 0};
+			else entry = {&CPU::OpOneArg<&CPU::CP_a_r8>, z, 0};
 		}
-		else if (z == 1)
+		else
 		{
-			if (q == 0) cycles = LD_r16_imm16(p);
-			else if (q == 1) cycles = ADD_HL_r16(p);
-			else return UninplementedOpcode(opcode);
+			if (z == 0)
+			{
+				if (y <= 3) entry = {&CPU::OpOneArg<&CPU::RET_C>, y, 0};
+				else if (y == 4) entry = {&CPU::OpNoArgs<&CPU::LDH_imm8_a>, 0, 0};
+				else if (y == 5) entry = {&CPU::OpNoArgs<&CPU::ADD_SP_imm8>, 0, 0};
+				else if (y == 6) entry = {&CPU::OpNoArgs<&CPU::LDH_a_imm8>, 0, 0};
+				else entry = {&CPU::OpNoArgs<&CPU::LD_HL_SLimm8>, 0, 0};
+			}
+			else if (z == 1)
+			{
+				if (q == 0) entry = {&CPU::OpOneArg<&CPU::POP_r16>, p, 0};
+				else if (y == 1) entry = {&CPU::OpNoArgs<&CPU::RET>, 0, 0};
+				else if (y == 3) entry = {&CPU::OpNoArgs<&CPU::RETI>, 0, 0};
+				else if (y == 5) entry = {&CPU::OpNoArgs<&CPU::JP_HL>, 0, 0};
+				else if (y == 7) entry = {&CPU::OpNoArgs<&CPU::LD_SP_HL>, 0, 0};
+			}
+			else if (z == 2)
+			{
+				if (y <= 3) entry = {&CPU::OpOneArg<&CPU::JP_C_imm16>, y, 0};
+				else if (y == 4) entry = {&CPU::OpNoArgs<&CPU::LDH_c_a>, 0, 0};
+				else if (y == 5) entry = {&CPU::OpNoArgs<&CPU::LD_imm16_a>, 0, 0};
+				else if (y == 6) entry = {&CPU::OpNoArgs<&CPU::LDH_a_c>, 0, 0};
+				else entry = {&CPU::OpNoArgs<&CPU::LD_a_imm16>, 0, 0};
+			}
+			else if (z == 3)
+			{
+				if (y == 0) entry = {&CPU::OpNoArgs<&CPU::JP_imm16>, 0, 0};
+				else if (y == 1) entry = {&CPU::PrefixCB, 0, 0};
+				else if (y == 6) entry = {&CPU::OpNoArgs<&CPU::DI>, 0, 0};
+				else if (y == 7) entry = {&CPU::OpNoArgs<&CPU::EI>, 0, 0};
+			}
+			else if (z == 4)
+			{
+				if (y <= 3) entry = {&CPU::OpOneArg<&CPU::CALL_C_imm16>, y, 0};
+			}
+			else if (z == 5)
+			{
+				if (q == 0) entry = {&CPU::OpOneArg<&CPU::PUSH_r16>, p, 0};
+				else if (y == 1) entry = {&CPU::OpNoArgs<&CPU::CALL_imm16>, 0, 0};
+			}
+			else if (z == 6)
+			{
+				if (y == 0) entry = {&CPU::OpNoArgs<&CPU::ADD_a_imm8>, 0, 0};
+				else if (y == 1) entry = {&CPU::OpNoArgs<&CPU::ADC_a_imm8>, 0, 0};
+				else if (y == 2) entry = {&CPU::OpNoArgs<&CPU::SUB_a_imm8>, 0, 0};
+				else if (y == 3) entry = {&CPU::OpNoArgs<&CPU::SBC_a_imm8>, 0, 0};
+				else if (y == 4) entry = {&CPU::OpNoArgs<&CPU::AND_a_imm8>, 0, 0};
+				else if (y == 5) entry = {&CPU::OpNoArgs<&CPU::XOR_a_imm8>, 0, 0};
+				else if (y == 6) entry = {&CPU::OpNoArgs<&CPU::OR_a_imm8>, 0, 0};
+				else entry = {&CPU::OpNoArgs<&CPU::CP_a_imm8>, 0, 0};
+			}
+			else entry = {&CPU::OpOneArg<&CPU::RST_tgt3>, y, 0};
 		}
-		else if (z == 2)
+	}
+
+	return table;
+}
+
+constexpr std::array<CPU::OpcodeEntry, 256> CPU::BuildCBOpcodeTable()
+{
+	std::array<OpcodeEntry, 256> table{};
+
+	for (int i = 0; i < 256; i++)
+	{
+		unsigned char opcode = i;
+
+		unsigned char block = opcode >> 6;
+		unsigned char y = (opcode & 0b00111000) >> 3;
+		unsigned char z = opcode & 0b00000111;
+
+		OpcodeEntry &entry = table[i];
+
+		if (block == 0)
 		{
-			if (q == 0) cycles = LD_r16_a(p);
-			else if (q == 1) cycles = LD_a_r16(p);
-			else return UninplementedOpcode(opcode);
+			if (y == 0) entry = {&CPU::OpOneArg<&CPU::RLC_r8>, z, 0};
+			else if (y == 1) entry = {&CPU::OpOneArg<&CPU::RRC_r8>, z, 0};
+			else if (y == 2) entry = {&CPU::OpOneArg<&CPU::RL_r8>, z, 0};
+			else if (y == 3) entry = {&CPU::OpOneArg<&CPU::RR_r8>, z, 0};
+			else if (y == 4) entry = {&CPU::OpOneArg<&CPU::SLA_r8>, z, 0};
+			else if (y == 5) entry = {&CPU::OpOneArg<&CPU::SRA_r8>, z, 0};
+			else if (y == 6) entry = {&CPU::OpOneArg<&CPU::SWAP_r8>, z, 0};
+			else entry = {&CPU::OpOneArg<&CPU::SRL_r8>, z, 0};
 		}
-		else if (z == 3)
+		else if (block == 1) entry = {&CPU::BIT, y, z};
+		else if (block == 2) entry = {&CPU::RES, y, z};
+		else entry = {&CPU::SET, y, z};
+	}
+
+	return table;
+}
+
+constexpr std::array<CPU::OpcodeEntry, 256> CPU::s_OpcodeTable = CPU::BuildOpcodeTable();
+constexpr std::array<CPU::OpcodeEntry, 256> CPU::s_CBOpcodeTable = CPU::BuildCBOpcodeTable();
+
+constexpr std::array<std::array<unsigned short, 512>, 8> CPU::BuildShiftTable()
+{
+	std::array<std::array<unsigned short, 512>, 8> table{};
+
+	for (unsigned int index = 0; index < 512; index++)
+	{
+		unsigned int value = index & 0xFF;
+		unsigned int carry = index >> 8;
+		unsigned int high = (value >> 7) << 8; // Bit 7 shifted out as the carry
+		unsigned int low = (value & 0x01) << 8; // Bit 0 shifted out as the carry
+
+		table[0][index] = (((value << 1) | (value >> 7)) & 0xFF) | high; // RLC
+		table[1][index] = (((value >> 1) | (value << 7)) & 0xFF) | low;	 // RRC
+		table[2][index] = (((value << 1) | carry) & 0xFF) | high;		 // RL
+		table[3][index] = ((value >> 1) | (carry << 7)) | low;			 // RR
+		table[4][index] = ((value << 1) & 0xFF) | high;					 // SLA
+		table[5][index] = ((value >> 1) | (value & 0x80)) | low;		 // SRA
+		table[6][index] = ((value << 4) | (value >> 4)) & 0xFF;			 // SWAP
+		table[7][index] = (value >> 1) | low;							 // SRL
+	}
+
+	return table;
+}
+
+constexpr std::array<unsigned short, 2048> CPU::BuildDaaTable()
+{
+	// Implementation from https://blog.ollien.com/posts/gb-daa/
+	std::array<unsigned short, 2048> table{};
+
+	for (unsigned int index = 0; index < 2048; index++)
+	{
+		unsigned char a = index & 0xFF;
+		bool carry = (index >> 8) & 1;
+		bool halfCarry = (index >> 9) & 1;
+		bool subtract = (index >> 10) & 1;
+		unsigned char offset = 0x00;
+
+		if ((subtract == 0 && (a & 0xF) > 0x09) || halfCarry)
 		{
-			if (q == 0) cycles = INC_r16(p);
-			else if (q == 1) cycles = DEC_r16(p);
-			else return UninplementedOpcode(opcode);
+			offset |= 0x06;
 		}
-		else if (z == 4) cycles = INC_r8(y);
-		else if (z == 5) cycles = DEC_r8(y);
-		else if (z == 6) cycles = LD_r8_imm8(y);
-		else if (z == 7)
+
+		if ((subtract == 0 && a > 0x99) || carry)
 		{
-			if (y == 0) cycles = RLCA();
-			else if (y == 1) cycles = RRCA();
-			else if (y == 2) cycles = RLA();
-			else if (y == 3) cycles = RRA();
-			else if (y == 4) cycles = DAA();
-			else if (y == 5) cycles = CPL();
-			else if (y == 6) cycles = SCF();
-			else if (y == 7) cycles = CCF();
-			else return UninplementedOpcode(opcode);
+			offset |= 0x60;
+			carry = true;
 		}
-		else return UninplementedOpcode(opcode);
+
+		if (subtract) a -= offset;
+		else a += offset;
+
+		table[index] = a | (carry << 8);
 	}
-	else if (block == 1)
+
+	return table;
+}
+
+constexpr std::array<std::array<unsigned short, 512>, 8> CPU::s_ShiftTable = CPU::BuildShiftTable();
+constexpr std::array<unsigned short, 2048> CPU::s_DaaTable = CPU::BuildDaaTable();
+
+template <unsigned char Opcode>
+int CPU::Execute()
+{
+	constexpr OpcodeEntry entry = s_OpcodeTable[Opcode];
+	return (this->*entry.handler)(entry.x, entry.y);
+}
+
+int CPU::RunUntil(int cycles)
+{
+#if defined(BITDMG_BLOCK_CACHE)
+	int elapsed = RunBlocks(cycles);
+#elif defined(BITDMG_THREADED_CORE)
+	int elapsed = RunThreaded(cycles);
+#else
+	int elapsed = 0;
+	while (elapsed < cycles)
 	{
-		if (opcode == 0x76) cycles = HALT();
-		else cycles = LD_r8_r8(y, z);
+		int opcodeCycles = Cycle();
+		if (opcodeCycles == -1) return -1;
+
+		elapsed += opcodeCycles;
+		m_Mem->AddPendingCycles(opcodeCycles);
+
+		if (m_Halted || m_Mem->TakeScheduleChange() || (m_JumpedBack && DetectIdleLoop())) break;
 	}
-	else if (block == 2)
+#endif
+
+	m_Mem->Sync();
+
+	// Stop the emulator once the reference trace diverged or ended
+	if (m_TraceComparer && m_TraceComparer->IsFinished()) return -1;
+
+	return elapsed;
+}
+
+// Every main opcode, used to generate one handler per opcode in the threaded interpreter
+#define BITDMG_OPCODE_LIST(X) \
+	X(00) X(01) X(02) X(03) X(04) X(05) X(06) X(07) X(08) X(09) X(0A) X(0B) X(0C) X(0D) X(0E) X(0F) \
+	X(10) X(11) X(12) X(13) X(14) X(15) X(16) X(17) X(18) X(19) X(1A) X(1B) X(1C) X(1D) X(1E) X(1F) \
+	X(20) X(21) X(22) X(23) X(24) X(25) X(26) X(27) X(28) X(29) X(2A) X(2B) X(2C) X(2D) X(2E) X(2F) \
+	X(30) X(31) X(32) X(33) X(34) X(35) X(36) X(37) X(38) X(39) X(3A) X(3B) X(3C) X(3D) X(3E) X(3F) \
+	X(40) X(41) X(42) X(43) X(44) X(45) X(46) X(47) X(48) X(49) X(4A) X(4B) X(4C) X(4D) X(4E) X(4F) \
+	X(50) X(51) X(52) X(53) X(54) X(55) X(56) X(57) X(58) X(59) X(5A) X(5B) X(5C) X(5D) X(5E) X(5F) \
+	X(60) X(61) X(62) X(63) X(64) X(65) X(66) X(67) X(68) X(69) X(6A) X(6B) X(6C) X(6D) X(6E) X(6F) \
+	X(70) X(71) X(72) X(73) X(74) X(75) X(76) X(77) X(78) X(79) X(7A) X(7B) X(7C) X(7D) X(7E) X(7F) \
+	X(80) X(81) X(82) X(83) X(84) X(85) X(86) X(87) X(88) X(89) X(8A) X(8B) X(8C) X(8D) X(8E) X(8F) \
+	X(90) X(91) X(92) X(93) X(94) X(95) X(96) X(97) X(98) X(99) X(9A) X(9B) X(9C) X(9D) X(9E) X(9F) \
+	X(A0) X(A1) X(A2) X(A3) X(A4) X(A5) X(A6) X(A7) X(A8) X(A9) X(AA) X(AB) X(AC) X(AD) X(AE) X(AF) \
+	X(B0) X(B1) X(B2) X(B3) X(B4) X(B5) X(B6) X(B7) X(B8) X(B9) X(BA) X(BB) X(BC) X(BD) X(BE) X(BF) \
+	X(C0) X(C1) X(C2) X(C3) X(C4) X(C5) X(C6) X(C7) X(C8) X(C9) X(CA) X(CB) X(CC) X(CD) X(CE) X(CF) \
+	X(D0) X(D1) X(D2) X(D3) X(D4) X(D5) X(D6) X(D7) X(D8) X(D9) X(DA) X(DB) X(DC) X(DD) X(DE) X(DF) \
+	X(E0) X(E1) X(E2) X(E3) X(E4) X(E5) X(E6) X(E7) X(E8) X(E9) X(EA) X(EB) X(EC) X(ED) X(EE) X(EF) \
+	X(F0) X(F1) X(F2) X(F3) X(F4) X(F5) X(F6) X(F7) X(F8) X(F9) X(FA) X(FB) X(FC) X(FD) X(FE) X(FF)
+
+// Labels as values are a GCC/Clang extension, other compilers use the switch based loop
+#if defined(__GNUC__) || defined(__clang__)
+#define BITDMG_COMPUTED_GOTO
+#endif
+
+// Bookkeeping done after every opcode (same as the end of CPU::Cycle)
+#define BITDMG_RETIRE()                                      \
+	if (cycles == -1) return -1;                             \
+	m_InstructionCount++;                                    \
+	if constexpr (PROFILE_OPCODES)                           \
+		m_Profiler.Record(opcode == 0xCB ? 0x100 | m_Mem->ReadU8Unfiltered(operandAddress) : opcode, cycles); \
+	if (m_EnableIME && opcode != 0xFB)                       \
+	{                                                        \
+		m_IME = true;                                        \
+		m_EnableIME = false;                                 \
+	}                                                        \
+	Instrument(cycles);                                      \
+	m_Mem->AddPendingCycles(cycles);                         \
+	elapsed += cycles;                                       \
+	if (m_Mem->TakeScheduleChange()) return elapsed;         \
+	if (m_JumpedBack && DetectIdleLoop()) return elapsed;
+
+// Handle interrupts & HALT and fetch the next opcode (same as the start of CPU::Cycle)
+#define BITDMG_FETCH()                                       \
+	if (elapsed >= budget) return elapsed;                   \
+	CheckInterrupts();                                       \
+	if (m_Halted) goto halted;                               \
+	TraceOpcode();                                           \
+	if (m_Coverage) m_Coverage->Mark(m_PC, GetBank(m_PC));   \
+	opcode = ReadCode(m_PC++);                               \
+	if (m_HaltBug)                                           \
+	{                                                        \
+		m_PC--;                                              \
+		m_HaltBug = false;                                   \
+	}                                                        \
+	operandAddress = m_PC;
+
+int CPU::RunThreaded(int budget)
+{
+	int elapsed = 0;
+	int cycles = 0;
+	unsigned char opcode = 0;
+	unsigned short operandAddress = 0;
+
+#ifdef BITDMG_COMPUTED_GOTO
+	// Direct threading, every handler fetches and jumps to the next one on its own
+#define BITDMG_OPCODE_LABEL(op) &&op_##op,
+#define BITDMG_OPCODE_HANDLER(op)                            \
+	op_##op:                                                 \
+	cycles = Execute<0x##op>();                              \
+	BITDMG_RETIRE();                                         \
+	BITDMG_FETCH();                                          \
+	goto *dispatchTable[opcode];
+
+	static void *const dispatchTable[256] = {BITDMG_OPCODE_LIST(BITDMG_OPCODE_LABEL)};
+
+	BITDMG_FETCH();
+	goto *dispatchTable[opcode];
+
+	BITDMG_OPCODE_LIST(BITDMG_OPCODE_HANDLER)
+
+halted:
+	// Let the caller skip ahead to the next event instead of ticking one cycle at a time
+	return elapsed;
+
+#undef BITDMG_OPCODE_LABEL
+#undef BITDMG_OPCODE_HANDLER
+#else
+	// Portable fallback, a single switch with every opcode handler inlined
+#define BITDMG_OPCODE_CASE(op)                               \
+	case 0x##op:                                             \
+		cycles = Execute<0x##op>();                          \
+		break;
+
+	while (true)
 	{
-		if (y == 0) cycles = ADD_a_r8(z);
-		else if (y == 1) cycles = ADC_a_r8(z);
-		else if (y == 2) cycles = SUB_a_r8(z);
-		else if (y == 3) cycles = SBC_a_r8(z);
-		else if (y == 4) cycles = AND_a_r8(z);
-		else if (y == 5) cycles = XOR_a_r8(z);
-		else if (y == 6) cycles = OR_a_r8(z);
-		else if (y == 7) cycles = CP_a_r8(z);
-		else return UninplementedOpcode(opcode);
+		BITDMG_FETCH();
+
+		switch (opcode)
+		{
+			BITDMG_OPCODE_LIST(BITDMG_OPCODE_CASE)
+		}
+
+		BITDMG_RETIRE();
+		continue;
+
 	}
-	else if (block == 3)
+
+halted:
+	// Let the caller skip ahead to the next event instead of ticking one cycle at a time
+	return elapsed;
+
+#undef BITDMG_OPCODE_CASE
+#endif
+}
+
+int CPU::RunBlocks(int budget)
+{
+	int elapsed = 0;
+	int cycles = 0;
+	unsigned char opcode = 0;
+	unsigned short operandAddress = 0;
+
+	Block *block = nullptr;
+	size_t next = 0;
+
+	while (elapsed < budget)
 	{
-		if (z == 0)
+		CheckInterrupts();
+		if (m_Halted) return elapsed;
+		TraceOpcode();
+
+		// Stay in the block unless PC left it (taken branch, interrupt) or the code under it changed
+		if (m_CodeChanged || block == nullptr || next == block->opcodes.size() || block->opcodes[next].address != m_PC)
 		{
-			if (y <= 3) cycles = RET_C(y);
-			else if (y == 4) cycles = LDH_imm8_a();
-			else if (y == 5) cycles = ADD_SP_imm8();
-			else if (y == 6) cycles = LDH_a_imm8();
-			else if (y == 7) cycles = LD_HL_SLimm8();
-			else return UninplementedOpcode(opcode);
+			m_CodeChanged = false;
+			block = m_HaltBug ? nullptr : GetBlock(m_PC);
+			next = 0;
+
+#if defined(BITDMG_JIT) || defined(BITDMG_STATIC_RECOMPILER)
+			// Native code skips the per opcode instrumentation & the EI delay
+			if (block != nullptr && !IsInstrumented() && !m_EnableIME)
+			{
+#ifdef BITDMG_STATIC_RECOMPILER
+				if (block->recompiled != nullptr)
+				{
+					CoverageRun coverageRun;
+					if (m_Coverage) BeginCoverageRun(*block, 0, block->opcodes.size(), coverageRun);
+
+					RecompiledState state = {m_Registers.r8, m_Registers.r16, &m_SP, &m_PC, &m_FlagRegister.result, &m_FlagRegister.operands,
+											 &m_FlagRegister.subtractOp, &m_InstructionCount, budget, elapsed, 0, &CPU::RecompiledExecute, this, block};
+
+					int status = block->recompiled(&state);
+					m_Mem->AddPendingCycles(state.pending);
+					elapsed = state.elapsed;
+					if (m_Coverage) EndCoverageRun(coverageRun);
+
+					if (status == JIT_RETURN) return elapsed;
+
+					block = nullptr;
+					continue;
+				}
+#endif
+#ifdef BITDMG_JIT
+				if (block->native == nullptr && ++block->runs == JIT_THRESHOLD) CompileBlock(*block);
+
+				if (block->native != nullptr)
+				{
+					CoverageRun coverageRun;
+					if (m_Coverage) BeginCoverageRun(*block, 0, block->opcodes.size(), coverageRun);
+
+					JitContext context;
+					context.budget = budget;
+					context.elapsed = elapsed;
+					context.pending = 0;
+
+					int status = block->native(this, &context);
+					m_Mem->AddPendingCycles(context.pending);
+					elapsed = context.elapsed;
+					if (m_Coverage) EndCoverageRun(coverageRun);
+
+					if (status == JIT_RETURN) return elapsed;
+
+					block = nullptr;
+					continue;
+				}
+#endif
+			}
+#endif
 		}
-		else if (z == 1)
+
+		if (block != nullptr)
 		{
-			if (q == 0) cycles = POP_r16(p);
-			else if (y == 1) cycles = RET();
-			else if (y == 3) cycles = RETI();
-			else if (y == 5) cycles = JP_HL();
-			else if (y == 7) cycles = LD_SP_HL();
-			else return UninplementedOpcode(opcode);
+			// Fused sequences skip the per opcode instrumentation & the EI delay too
+			if (block->opcodes[next].fused != Superinstruction::None && !IsInstrumented() && !m_EnableIME)
+			{
+				CoverageRun coverageRun;
+				if (m_Coverage) BeginCoverageRun(*block, next, SUPERINSTRUCTION_LENGTHS[(size_t)block->opcodes[next].fused], coverageRun);
+
+				bool leave = RunSuperinstruction(block, next, budget, elapsed);
+				if (m_Coverage) EndCoverageRun(coverageRun);
+
+				if (leave) return elapsed;
+				continue;
+			}
+
+			const DecodedOpcode &decoded = block->opcodes[next++];
+			opcode = decoded.opcode;
+			if (m_Coverage) m_Coverage->Mark(decoded.address, GetBank(decoded.address));
+			operandAddress = decoded.address + 1;
+
+			m_PC = decoded.address + decoded.operandOffset;
+			m_Operands = block->bytes.data() + (m_PC - block->start);
+			cycles = (this->*decoded.handler)(decoded.x, decoded.y);
+			m_Operands = nullptr;
 		}
-		else if (z == 2)
+		else
 		{
-			if (y <= 3) cycles = JP_C_imm16(y);
-			else if (y == 4) cycles = LDH_c_a();
-			else if (y == 5) cycles = LD_imm16_a();
-			else if (y == 6) cycles = LDH_a_c();
-			else if (y == 7) cycles = LD_a_imm16();
-			else return UninplementedOpcode(opcode);
+			// Code that isn't cached or the HALT bug, fetch & decode as usual
+			if (m_Coverage) m_Coverage->Mark(m_PC, GetBank(m_PC));
+			opcode = ReadCode(m_PC++);
+			if (m_HaltBug)
+			{
+				m_PC--;
+				m_HaltBug = false;
+			}
+			operandAddress = m_PC;
+
+			const OpcodeEntry &entry = s_OpcodeTable[opcode];
+			cycles = (this->*entry.handler)(entry.x, entry.y);
 		}
-		else if (z == 3)
+
+		BITDMG_RETIRE();
+	}
+
+	return elapsed;
+}
+
+#undef BITDMG_RETIRE
+#undef BITDMG_FETCH
+
+// Bookkeeping after every opcode of a superinstruction (same as BITDMG_RETIRE & the start of RunBlocks without the instrumentation)
+#define BITDMG_FUSED_RETIRE(opcodeCycles)                                              \
+	m_InstructionCount++;                                                              \
+	m_Mem->AddPendingCycles(opcodeCycles);                                             \
+	elapsed += opcodeCycles;                                                           \
+	if (m_Mem->TakeScheduleChange() || (m_JumpedBack && DetectIdleLoop()))             \
+	{                                                                                  \
+		leave = true;                                                                  \
+		goto done;                                                                     \
+	}                                                                                  \
+	if (elapsed >= budget || m_CodeChanged || (m_IME && m_Mem->IsInterruptPending())) \
+		goto done;
+
+bool CPU::RunSuperinstruction(Block *block, size_t &next, int budget, int &elapsed)
+{
+	// Operands are read before the first write, a write to the code under the block drops it
+	const DecodedOpcode decoded = block->opcodes[next];
+	const unsigned char *bytes = block->bytes.data() + (decoded.address - block->start);
+	unsigned short address = decoded.address;
+	unsigned long long startCount = m_InstructionCount;
+	bool leave = false;
+
+	switch (decoded.fused)
+	{
+	case Superinstruction::Copy:
+		// LD A, [HL+]
+		m_PC = address + 1;
+		m_Registers.a = m_Mem->ReadU8(m_Registers.hl++);
+		BITDMG_FUSED_RETIRE(2);
+
+		// LD [DE], A
+		m_PC = address + 2;
+		m_Mem->WriteU8(m_Registers.de, m_Registers.a);
+		BITDMG_FUSED_RETIRE(2);
+
+		// INC DE
+		m_PC = address + 3;
+		m_Registers.de++;
+		BITDMG_FUSED_RETIRE(2);
+
+		// DEC BC
+		m_PC = address + 4;
+		m_Registers.bc--;
+		BITDMG_FUSED_RETIRE(2);
+		break;
+
+	case Superinstruction::Countdown:
+	{
+		unsigned char &counter = m_Registers.r8[((decoded.opcode >> 3) & 0x07) ^ R8_INDEX_SWAP];
+		unsigned short branch = address + 1;
+		signed char offset = bytes[2];
+
+		// DEC r8; JR NZ, -3 spins here until the counter runs out
+		do
+		{
+			// DEC r8
+			unsigned char value = counter--;
+			m_FlagRegister.setIncDec(value, counter, true);
+			m_PC = branch;
+			BITDMG_FUSED_RETIRE(1);
+
+			// JR NZ, s8
+			m_PC = branch + 2;
+			if (counter == 0)
+			{
+				BITDMG_FUSED_RETIRE(2);
+				break;
+			}
+
+			m_PC += offset;
+			if (offset < 0) JumpBack(branch);
+			BITDMG_FUSED_RETIRE(3);
+		} while (m_PC == address);
+		break;
+	}
+
+	case Superinstruction::Poll:
+	{
+		unsigned char port = bytes[1];
+		bool immediate = bytes[2] == 0xE6;
+		unsigned char mask = immediate ? bytes[3] : 0x00;
+		unsigned char maskRegister = (bytes[2] & 0x07) ^ R8_INDEX_SWAP;
+		unsigned short branch = address + (immediate ? 4 : 3);
+		signed char offset = bytes[branch + 1 - address];
+
+		do
+		{
+			// LDH A, [imm8]
+			m_PC = address + 2;
+			m_Registers.a = m_Mem->ReadU8(0xFF00 | port);
+			BITDMG_FUSED_RETIRE(3);
+
+			// AND imm8, AND r8
+			m_PC = branch;
+			m_Registers.a &= immediate ? mask : m_Registers.r8[maskRegister];
+			m_FlagRegister.setLogic(m_Registers.a, true);
+			BITDMG_FUSED_RETIRE(immediate ? 2 : 1);
+
+			// JR Z, s8
+			m_PC = branch + 2;
+			if (m_Registers.a != 0)
+			{
+				BITDMG_FUSED_RETIRE(2);
+				break;
+			}
+
+			m_PC += offset;
+			if (offset < 0) JumpBack(branch);
+			BITDMG_FUSED_RETIRE(3);
+		} while (m_PC == address);
+		break;
+	}
+
+	default:
+		break;
+	}
+
+done:
+	m_FusedRuns[(size_t)decoded.fused]++;
+	m_FusedOpcodes[(size_t)decoded.fused] += m_InstructionCount - startCount;
+
+	// Continue in the block from PC, RunBlocks looks the block up again if PC left it or the code changed
+	next = 0;
+	if (!m_CodeChanged)
+	{
+		while (next < block->opcodes.size() && block->opcodes[next].address < m_PC) next++;
+	}
+
+	return leave;
+}
+
+#undef BITDMG_FUSED_RETIRE
+
+void CPU::LogSuperinstructions(const std::string &romName)
+{
+	static const char *const names[] = {"", "copy", "countdown", "poll"};
+
+	unsigned long long fused = 0;
+	std::stringstream details;
+	for (size_t i = 1; i < (size_t)Superinstruction::Count; i++)
+	{
+		fused += m_FusedOpcodes[i];
+		details << ", " << names[i] << " " << m_FusedRuns[i] << " runs (" << m_FusedOpcodes[i] << " opcodes)";
+	}
+
+	double rate = m_InstructionCount == 0 ? 0.0 : 100.0 * fused / m_InstructionCount;
+
+	std::stringstream str;
+	str << std::fixed << std::setprecision(2) << "Superinstructions in " << romName << ": " << fused << " of " << m_InstructionCount << " opcodes fused ("
+		<< rate << "%)" << details.str();
+	Log::LogInfo(str.str().c_str());
+}
+
+void CPU::BeginCoverageRun(const Block &block, size_t first, size_t count, CoverageRun &run)
+{
+	run.count = count;
+	for (size_t i = 0; i < count; i++) run.addresses[i] = block.opcodes[first + i].address;
+
+	run.bank = m_Mem->GetRomBank();
+	run.startCount = m_InstructionCount;
+}
+
+void CPU::EndCoverageRun(const CoverageRun &run)
+{
+	// Loops (fused polling & countdowns) retire more opcodes than they have, they all ran then
+	size_t executed = std::min<unsigned long long>(run.count, m_InstructionCount - run.startCount);
+
+	for (size_t i = 0; i < executed; i++)
+	{
+		unsigned short address = run.addresses[i];
+		m_Coverage->Mark(address, (address >= 0x4000 && address <= 0x7FFF) ? run.bank : 0);
+	}
+}
+
+#if defined(BITDMG_JIT) || defined(BITDMG_STATIC_RECOMPILER)
+int CPU::JitExecute(CPU *cpu, Block *block, int index, JitContext *context)
+{
+	// The opcode can drop the block (self-modifying code), don't touch it afterwards
+	const DecodedOpcode decoded = block->opcodes[index];
+	bool last = (size_t)index + 1 == block->opcodes.size();
+	unsigned short next = last ? 0 : block->opcodes[index + 1].address;
+
+	// Native opcodes before this one, memory accesses sync the PPU & timers up to now
+	cpu->m_Mem->AddPendingCycles(context->pending);
+	context->pending = 0;
+
+	cpu->m_PC = decoded.address + decoded.operandOffset;
+	cpu->m_Operands = block->bytes.data() + (cpu->m_PC - block->start);
+	int cycles = (cpu->*decoded.handler)(decoded.x, decoded.y);
+	cpu->m_Operands = nullptr;
+
+	// Same as the end of RunBlocks
+	if (cycles == -1)
+	{
+		context->elapsed = -1;
+		return JIT_RETURN;
+	}
+
+	cpu->m_InstructionCount++;
+	if (cpu->m_EnableIME && decoded.opcode != 0xFB)
+	{
+		cpu->m_IME = true;
+		cpu->m_EnableIME = false;
+	}
+	cpu->Instrument(cycles);
+	cpu->m_Mem->AddPendingCycles(cycles);
+	context->elapsed += cycles;
+	if (cpu->m_Mem->TakeScheduleChange()) return JIT_RETURN;
+	if (cpu->m_JumpedBack && cpu->DetectIdleLoop()) return JIT_RETURN;
+
+	// Same as the start of RunBlocks, native opcodes can't handle interrupts, the EI delay or a changed block
+	if (last || context->elapsed >= context->budget) return JIT_CONTINUE;
+	cpu->CheckInterrupts();
+	if (cpu->m_Halted || cpu->m_EnableIME || cpu->m_CodeChanged || cpu->m_PC != next) return JIT_CONTINUE;
+
+	return JIT_STAY;
+}
+#endif
+
+CPU::Block *CPU::GetBlock(unsigned short address)
+{
+	unsigned int key = ((unsigned int)GetBank(address) << 16) | address;
+
+	BlockLookup &lookup = m_BlockLookup[address % m_BlockLookup.size()];
+	if (lookup.key == key) return lookup.block;
+
+	auto block = m_Blocks.find(key);
+	if (block == m_Blocks.end())
+	{
+		Block decoded;
+		if (!DecodeBlock(address, decoded, [this](unsigned short address) { return m_Mem->ReadU8Unfiltered(address); })) return nullptr;
+
+#ifdef BITDMG_STATIC_RECOMPILER
+		// Ahead of time translation of the same bytes
+		if (m_Recompiled && address <= 0x7FFF) decoded.recompiled = m_Recompiled->Find(key, decoded.end, decoded.opcodes.size());
+#endif
+
+		block = m_Blocks.emplace(key, std::move(decoded)).first;
+
+		// Writes to RAM holding the block have to drop it
+		if (address >= 0x8000)
 		{
-			if (y == 0) cycles = JP_imm16();
-			else if (y == 6) cycles = DI();
-			else if (y == 7) cycles = EI();
-			else return UninplementedOpcode(opcode);
+			const Block &added = block->second;
+			for (int page = added.start / Memory::CODE_PAGE_SIZE; page <= (added.end - 1) / Memory::CODE_PAGE_SIZE; page++)
+			{
+				m_PageBlocks[page].push_back({added.start, added.end});
+				m_Mem->SetCodePage(page * Memory::CODE_PAGE_SIZE, true);
+			}
 		}
-		else if (z == 4) cycles = CALL_C_imm16(y);
-		else if (z == 5)
+	}
+
+	lookup = {key, &block->second};
+	return lookup.block;
+}
+
+bool CPU::DecodeBlock(unsigned short start, Block &block, const std::function<unsigned char(unsigned short)> &read)
+{
+	// Blocks stay in one memory region (and ROM bank), other regions aren't cached
+	unsigned int limit;
+	if (start <= 0x3FFF) limit = 0x4000;
+	else if (start <= 0x7FFF) limit = 0x8000;
+	else if (start >= 0xC000 && start <= 0xDFFF) limit = 0xE000;
+	else if (start >= 0xFF80 && start <= 0xFFFE) limit = 0xFFFF;
+	else return false;
+
+	unsigned int address = start;
+	while (block.opcodes.size() < MAX_BLOCK_LENGTH)
+	{
+		unsigned char opcode = read(address);
+		int length = GetOpcodeLength(opcode);
+		if (address + length > limit) break;
+
+		bool prefixed = opcode == 0xCB;
+		const OpcodeEntry &entry = prefixed ? s_CBOpcodeTable[read(address + 1)] : s_OpcodeTable[opcode];
+		if (entry.handler == &CPU::InvalidOpcode) break;
+
+		block.opcodes.push_back({entry.handler, entry.x, entry.y, opcode, (unsigned char)(prefixed ? 2 : 1), (unsigned short)address});
+
+		for (int i = 0; i < length; i++)
 		{
-			if (q == 0) cycles = PUSH_r16(p);
-			else if (y == 1) cycles = CALL_imm16();
-			else return UninplementedOpcode(opcode);
+			block.bytes.push_back(read(address + i));
 		}
-		else if (z == 6)
+
+		address += length;
+		if (EndsBlock(opcode)) break;
+	}
+
+	for (size_t i = 0; i < block.opcodes.size(); i++)
+	{
+		block.opcodes[i].fused = MatchSuperinstruction(block.opcodes, i);
+	}
+
+	block.start = start;
+	block.end = address;
+	return !block.opcodes.empty();
+}
+
+CPU::Superinstruction CPU::MatchSuperinstruction(const std::vector<DecodedOpcode> &opcodes, size_t index)
+{
+	size_t remaining = opcodes.size() - index;
+	auto opcode = [&](size_t offset) { return opcodes[index + offset].opcode; };
+
+	// LD A, [HL+]; LD [DE], A; INC DE; DEC BC
+	if (remaining >= 4 && opcode(0) == 0x2A && opcode(1) == 0x12 && opcode(2) == 0x13 && opcode(3) == 0x0B) return Superinstruction::Copy;
+
+	// DEC r8 (not [HL]); JR NZ, s8
+	if (remaining >= 2 && (opcode(0) & 0xC7) == 0x05 && opcode(0) != 0x35 && opcode(1) == 0x20) return Superinstruction::Countdown;
+
+	// LDH A, [imm8]; AND imm8 or AND r8 (not [HL]); JR Z, s8
+	if (remaining >= 3 && opcode(0) == 0xF0 && (opcode(1) == 0xE6 || ((opcode(1) & 0xF8) == 0xA0 && opcode(1) != 0xA6)) && opcode(2) == 0x28)
+		return Superinstruction::Poll;
+
+	return Superinstruction::None;
+}
+
+unsigned char CPU::ReadCodeSlow(unsigned short address)
+{
+	if (address <= 0x7FFF)
+	{
+		// Stays valid until the next mapper write (InvalidateCode)
+		const unsigned char *window = m_Mem->GetRomRegion(address);
+		m_CodeWindows[address >> 14] = window;
+		if (window != nullptr) return window[address & 0x3FFF];
+	}
+
+	return m_Mem->ReadU8(address);
+}
+
+void CPU::InvalidateCode(unsigned short address)
+{
+	// Mapper write, the blocks are kept per bank but the running one may belong to the previous bank
+	if (address <= 0x7FFF)
+	{
+		m_CodeChanged = true;
+		m_CodeWindows.fill(nullptr);
+		return;
+	}
+
+	std::vector<CodeRange> &ranges = m_PageBlocks[address / Memory::CODE_PAGE_SIZE];
+	bool erased = false;
+
+	for (size_t i = ranges.size(); i-- > 0;)
+	{
+		CodeRange range = ranges[i];
+		if (address < range.start || address >= range.end) continue;
+
+		// Unlink the block from every page it covers, this one included
+		for (int page = range.start / Memory::CODE_PAGE_SIZE; page <= (range.end - 1) / Memory::CODE_PAGE_SIZE; page++)
 		{
-			if (y == 0) cycles = ADD_a_imm8();
-			else if (y == 1) cycles = ADC_a_imm8();
-			else if (y == 2) cycles = SUB_a_imm8();
-			else if (y == 3) cycles = SBC_a_imm8();
-			else if (y == 4) cycles = AND_a_imm8();
-			else if (y == 5) cycles = XOR_a_imm8();
-			else if (y == 6) cycles = OR_a_imm8();
-			else if (y == 7) cycles = CP_a_imm8();
-			else return UninplementedOpcode(opcode);
+			std::vector<CodeRange> &pageRanges = m_PageBlocks[page];
+			for (size_t j = 0; j < pageRanges.size(); j++)
+			{
+				if (pageRanges[j].start != range.start) continue;
+
+				pageRanges.erase(pageRanges.begin() + j);
+				break;
+			}
+
+			if (pageRanges.empty()) m_Mem->SetCodePage(page * Memory::CODE_PAGE_SIZE, false);
 		}
-		else if (z == 7) cycles = RST_tgt3(y);
-		else return UninplementedOpcode(opcode);
+
+		m_Blocks.erase(range.start);
+		erased = true;
 	}
-	else return UninplementedOpcode(opcode);
 
-	// Enable interrupts after the instruction (used by the EI instruction)
-	if (m_EnableIME && opcode != 0xFB)
+	if (erased)
 	{
-		m_IME = true;
-		m_EnableIME = false;
+		m_BlockLookup.fill({0xFFFFFFFF, nullptr});
+		m_CodeChanged = true;
 	}
+}
+
+int CPU::SkipHalt(int cycles)
+{
+	if (m_Halted == false) return 0;
+
+	// A pending interrupt wakes the CPU up on the next cycle
+	if (m_Mem->IsInterruptPending()) return 0;
 
-	//Log();
+	Instrument(cycles);
 	return cycles;
 }
 
-int CPU::CheckInterrupts()
+int CPU::SkipIdleLoop(int cycles)
+{
+	m_IdleLoop = false;
+
+	if (m_EnableIME || m_HaltBug) return 0;
+
+	// An interrupt will be handled before the next opcode
+	if (m_IME && m_Mem->IsInterruptPending()) return 0;
+
+	Registers registers = m_Registers;
+	FlagRegister flags = m_FlagRegister;
+	unsigned short loopStart = m_PC;
+
+	// Run one iteration, if it leaves the CPU exactly as it was the loop will spin until the polled registers change
+	int iterationCycles = 0;
+	do
+	{
+		unsigned char opcode = ReadCode(m_PC++);
+		const OpcodeEntry &entry = s_OpcodeTable[opcode];
+		iterationCycles += (this->*entry.handler)(entry.x, entry.y);
+	} while (m_PC > loopStart && m_PC <= m_LoopEnd);
+
+	bool spinning = m_PC == loopStart && m_FlagRegister.toU8() == flags.toU8() &&
+					m_Registers.bc == registers.bc && m_Registers.de == registers.de && m_Registers.hl == registers.hl && m_Registers.a == registers.a;
+
+	// The loop doesn't write anything, restoring the registers undoes the iteration
+	m_Registers = registers;
+	m_FlagRegister = flags;
+	m_PC = loopStart;
+	m_JumpedBack = false;
+
+	if (!spinning) return 0;
+
+	// Only skip whole iterations that end before the next event
+	int skipped = ((cycles - 1) / iterationCycles) * iterationCycles;
+	m_SkippedCycles += skipped;
+	Instrument(skipped);
+
+	return skipped;
+}
+
+bool CPU::DetectIdleLoop()
+{
+	m_JumpedBack = false;
+
+	if (m_PC == m_RejectedLoop) return false;
+
+	// Skipped iterations would be missing from instruction traces
+	if (m_Tracer || m_TraceComparer) return false;
+
+	unsigned short address = m_PC;
+
+	// Polling loops are short
+	if (m_LoopEnd - address > 16)
+	{
+		m_RejectedLoop = m_PC;
+		return false;
+	}
+
+	while (address < m_LoopEnd)
+	{
+		unsigned char opcode = m_Mem->ReadU8(address);
+
+		// LD A, [imm8], LD A, [imm16]
+		if (opcode == 0xF0 && IsPollableAddress(0xFF00 + m_Mem->ReadU8(address + 1)))
+			address += 2;
+		else if (opcode == 0xFA && IsPollableAddress(m_Mem->ReadU16(address + 1)))
+			address += 3;
+		// LD A, [BC], LD A, [DE], LD A, [HL] (the loop can't change the pointer)
+		else if ((opcode == 0x0A && IsPollableAddress(GetBC())) || (opcode == 0x1A && IsPollableAddress(GetDE())) || (opcode == 0x7E && IsPollableAddress(GetHL())))
+			address += 1;
+		// AND, XOR, OR & CP between A and a register
+		else if (opcode >= 0xA0 && opcode <= 0xBF && (opcode & 0x7) != 6)
+			address += 1;
+		// AND, XOR, OR & CP between A and an immediate
+		else if (opcode == 0xE6 || opcode == 0xEE || opcode == 0xF6 || opcode == 0xFE)
+			address += 2;
+		// BIT b, r
+		else if (opcode == 0xCB && (m_Mem->ReadU8(address + 1) & 0xC0) == 0x40 && (m_Mem->ReadU8(address + 1) & 0x7) != 6)
+			address += 2;
+		else if (opcode == 0x00)
+			address += 1;
+		else
+			break;
+	}
+
+	// The loop must end exactly at the jump, any other opcode might have side effects
+	if (address != m_LoopEnd)
+	{
+		m_RejectedLoop = m_PC;
+		return false;
+	}
+
+	m_IdleLoop = true;
+	return true;
+}
+
+bool CPU::IsPollableAddress(unsigned short address)
+{
+	// WRAM & HRAM only change through writes (the loop doesn't write & interrupt handlers run on events)
+	if ((address >= 0xC000 && address <= 0xDFFF) || address >= 0xFF80) return true;
+
+	// IO registers, except the ones changing outside PPU/timer events (Joypad, DIV, TIMA) or with side effects
+	if (address >= 0xFF00 && address <= 0xFF7F)
+		return address != IO::JOY && address != IO::SB && address != IO::DIV && address != IO::TIMA;
+
+	return false;
+}
+
+void CPU::SetGuestProfiler(std::shared_ptr<GuestProfiler> profiler)
 {
-	unsigned char IE = m_Mem->ReadU8(IO::IE);
-	unsigned char IF = m_Mem->ReadU8(IO::IF);
+	m_GuestProfiler = profiler;
+}
 
-	if ((IF & IE) != 0) // Interrupt pending
+int CPU::CheckInterrupts()
+{
+	if (m_Mem->IsInterruptPending())
 	{
+		// Unfiltered, IE & IF only change on PPU/timer events or CPU writes
+		unsigned char IF = m_Mem->ReadU8Unfiltered(IO::IF);
+
 		m_Halted = false;
 
 		// If master enable is disabled, do not handle the interrupt
@@ -247,8 +1108,9 @@ int CPU::CheckInterrupts()
 				IF &= ~(0b1 << i); // Invert the byte that caused this interrupt
 				m_Mem->WriteU8Unfiltered(IO::IF, IF);
 
-				m_Mem->WriteU16Stack(--m_SP, m_PC);
-				m_SP--; // Adjust for the second write
+				if (m_GuestProfiler) m_GuestProfiler->Call(m_PC, GetBank(m_PC), m_SP - 2);
+
+				PushU16(m_PC);
 				m_PC = 0x40 + 0x08 * i; // Jump to the corresponding handler
 			}
 		}
@@ -260,114 +1122,135 @@ int CPU::CheckInterrupts()
 
 void CPU::SetR8(unsigned char reg, unsigned char value)
 {
-	switch (reg)
+	if (reg == 6)
 	{
-	case 0:
-		m_Registers.b = value;
-		break;
-
-	case 1:
-		m_Registers.c = value;
-		break;
-
-	case 2:
-		m_Registers.d = value;
-		break;
-
-	case 3:
-		m_Registers.e = value;
-		break;
-
-	case 4:
-		m_Registers.h = value;
-		break;
-
-	case 5:
-		m_Registers.l = value;
-		break;
-
-	case 6:
 		m_Mem->WriteU8(GetHL(), value);
-		break;
-
-	case 7:
-		m_Registers.a = value;
-		break;
+		return;
 	}
+
+	m_Registers.r8[reg ^ R8_INDEX_SWAP] = value;
 }
 
 unsigned char CPU::GetR8(unsigned char reg)
 {
-	switch (reg)
+	if (reg == 6)
 	{
-	case 0:
-		return m_Registers.b;
+		return m_Mem->ReadU8(GetHL());
+	}
 
-	case 1:
-		return m_Registers.c;
+	return m_Registers.r8[reg ^ R8_INDEX_SWAP];
+}
 
-	case 2:
-		return m_Registers.d;
+void CPU::SetR16(unsigned char reg, unsigned short value)
+{
+	if (reg == 3)
+	{
+		m_SP = value;
+		return;
+	}
 
-	case 3:
-		return m_Registers.e;
+	m_Registers.r16[reg] = value;
+}
 
-	case 4:
-		return m_Registers.h;
+unsigned short CPU::GetR16(unsigned char reg)
+{
+	if (reg == 3)
+	{
+		return m_SP;
+	}
 
-	case 5:
-		return m_Registers.l;
+	return m_Registers.r16[reg];
+}
 
-	case 6:
-		return m_Mem->ReadU8(GetHL());
+void CPU::SetJitVerify(bool verify)
+{
+#ifdef BITDMG_JIT
+	m_JitVerify = verify;
+#else
+	if (verify) Log::LogWarning("BitDMG was built without BITDMG_JIT, nothing to verify");
+#endif
+}
 
-	case 7:
-		return m_Registers.a;
-	}
+void CPU::SetRecompiledModule(std::shared_ptr<RecompiledModule> module)
+{
+#ifdef BITDMG_STATIC_RECOMPILER
+	m_Recompiled = module;
 
-	return -1;
+	// Blocks are bound to the module when decoded
+	m_Blocks.clear();
+	m_BlockLookup.fill({0xFFFFFFFF, nullptr});
+	for (std::vector<CodeRange> &ranges : m_PageBlocks) ranges.clear();
+	m_CodeChanged = true;
+#else
+	if (module) Log::LogWarning("BitDMG was built without BITDMG_STATIC_RECOMPILER, the recompiled module is ignored");
+#endif
 }
 
-void CPU::SetR16(unsigned char reg, unsigned short value)
+void CPU::SetTracer(std::shared_ptr<Tracer> tracer)
 {
-	switch (reg)
-	{
-	case 0:
-		SetBC(value);
-		break;
+	m_Tracer = tracer;
+}
 
-	case 1:
-		SetDE(value);
-		break;
+void CPU::SetCoverage(std::shared_ptr<Coverage> coverage)
+{
+	m_Coverage = coverage;
+}
 
-	case 2:
-		SetHL(value);
-		break;
+void CPU::SetTraceComparer(std::shared_ptr<TraceComparer> comparer)
+{
+	m_TraceComparer = comparer;
+}
 
-	case 3:
-		m_SP = value;
-		break;
-	}
+void CPU::Trace()
+{
+	TraceRecord record = GetTraceRecord();
+	if (m_Tracer) m_Tracer->Push(record);
+	if (m_TraceComparer) m_TraceComparer->Compare(record);
 }
 
-unsigned short CPU::GetR16(unsigned char reg)
+bool CPU::IsLockedUp()
 {
-	switch (reg)
+	return s_OpcodeTable[m_Mem->ReadU8Unfiltered(m_PC)].handler == &CPU::InvalidOpcode;
+}
+
+std::string CPU::GetStateDump()
+{
+	std::stringstream str;
+	str << std::hex << std::uppercase << std::setfill('0') << "pc=" << std::setw(4) << m_PC << " sp=" << std::setw(4) << m_SP << " af=" << std::setw(4) << GetAF()
+		<< " bc=" << std::setw(4) << GetBC() << " de=" << std::setw(4) << GetDE() << " hl=" << std::setw(4) << GetHL() << " bank=" << std::setw(2) << (int)GetBank(m_PC)
+		<< " ime=" << m_IME << " halted=" << m_Halted << " ie=" << std::setw(2) << (int)m_Mem->ReadU8Unfiltered(IO::IE) << " if=" << std::setw(2)
+		<< (int)m_Mem->ReadU8Unfiltered(IO::IF) << " mem=";
+
+	for (int i = 0; i < 4; i++)
 	{
-	case 0:
-		return GetBC();
+		str << (i == 0 ? "" : ",") << std::setw(2) << (int)m_Mem->ReadU8Unfiltered(m_PC + i);
+	}
 
-	case 1:
-		return GetDE();
+	return str.str();
+}
 
-	case 2:
-		return GetHL();
+TraceRecord CPU::GetTraceRecord()
+{
+	TraceRecord record;
+	record.cycle = 0;
+	record.sp = m_SP;
+	record.pc = m_PC;
+	record.a = m_Registers.a;
+	record.f = m_FlagRegister.toU8();
+	record.b = m_Registers.b;
+	record.c = m_Registers.c;
+	record.d = m_Registers.d;
+	record.e = m_Registers.e;
+	record.h = m_Registers.h;
+	record.l = m_Registers.l;
 
-	case 3:
-		return m_SP;
+	// Unfiltered, reading code shouldn't have side effects (joypad, PPU/timer sync)
+	for (int i = 0; i < 4; i++)
+	{
+		record.pcmem[i] = m_Mem->ReadU8Unfiltered(m_PC + i);
 	}
 
-	return -1;
+	return record;
 }
 
 void CPU::Log()
@@ -399,20 +1282,17 @@ void CPU::SetAF(unsigned short value)
 
 void CPU::SetBC(unsigned short value)
 {
-	this->m_Registers.b = value >> 8;
-	this->m_Registers.c = value;
+	this->m_Registers.bc = value;
 }
 
 void CPU::SetDE(unsigned short value)
 {
-	this->m_Registers.d = value >> 8;
-	this->m_Registers.e = value;
+	this->m_Registers.de = value;
 }
 
 void CPU::SetHL(unsigned short value)
 {
-	this->m_Registers.h = value >> 8;
-	this->m_Registers.l = value;
+	this->m_Registers.hl = value;
 }
 
 unsigned short CPU::GetAF()
@@ -422,45 +1302,34 @@ unsigned short CPU::GetAF()
 
 unsigned short CPU::GetBC()
 {
-	return ((unsigned short)this->m_Registers.b << 8) | this->m_Registers.c;
+	return this->m_Registers.bc;
 }
 
 unsigned short CPU::GetDE()
 {
-	return ((unsigned short)this->m_Registers.d << 8) | this->m_Registers.e;
+	return this->m_Registers.de;
 }
 
 unsigned short CPU::GetHL()
 {
-	return ((unsigned short)this->m_Registers.h << 8) | this->m_Registers.l;
+	return this->m_Registers.hl;
 }
 #pragma endregion
 
-bool CPU::IsValidOpcode(unsigned char opcode)
+// Opcode outside the valid region, the CPU locks up until it's reset
+int CPU::InvalidOpcode(unsigned char, unsigned char)
 {
-	return opcode != 0xD3 &&
-		opcode != 0xDB &&
-		opcode != 0xDD &&
-		opcode != 0xE3 &&
-		opcode != 0xE4 &&
-		opcode != 0xEB &&
-		opcode != 0xEC &&
-		opcode != 0xED &&
-		opcode != 0xF4 &&
-		opcode != 0xFC &&
-		opcode != 0xFD;
+	m_PC--;
+	return -1;
 }
 
-int CPU::UninplementedOpcode(int opcode)
+// Run the opcode following the 0xCB prefix
+int CPU::PrefixCB(unsigned char, unsigned char)
 {
-	// Print error to console
-	std::string errorTxt = "Opcode not found: ";
-	std::stringstream str;
-	str << std::hex << std::uppercase << (int)opcode;
-	errorTxt = errorTxt + str.str();
-	Log::LogError(errorTxt.c_str());
+	unsigned char opcode = ReadCode(m_PC++);
 
-	return -1;
+	const OpcodeEntry &entry = s_CBOpcodeTable[opcode];
+	return (this->*entry.handler)(entry.x, entry.y);
 }
 
 // No operation
@@ -472,8 +1341,7 @@ int CPU::NOP()
 // Copy the immediate value into register r16
 int CPU::LD_r16_imm16(unsigned char reg)
 {
-	unsigned short value = m_Mem->ReadU16(m_PC++);
-	m_PC++; // Adjust for the two memory reads for imm16
+	unsigned short value = FetchU16();
 	SetR16(reg, value);
 
 	return 3;
@@ -544,8 +1412,8 @@ int CPU::LD_a_r16(unsigned char reg)
 // Copy the immediate value into SP
 int CPU::LD_imm16_SP()
 {
-	unsigned char lsb = m_Mem->ReadU8(m_PC++);
-	unsigned char msb = m_Mem->ReadU8(m_PC++);
+	unsigned char lsb = FetchU8();
+	unsigned char msb = FetchU8();
 
 	unsigned short address = ((unsigned short)msb << 8) | lsb;
 
@@ -575,12 +1443,10 @@ int CPU::ADD_HL_r16(unsigned char reg)
 
 	unsigned short result = GetHL() + val;
 
-	// Set flags
-	m_FlagRegister.subtract = false;
-	m_FlagRegister.halfCarry = ((((result - val) & 0xFFF) + (val & 0xFFF)) & 0x1000) == 0x1000;
-	//m_FlagRegister.carry = ((((result - val) & 0xFFFF) + (val & 0xFFFF)) & 0x10000) == 0x10000;
-	int iVal = val;
-	m_FlagRegister.carry = (GetHL() + val) > 0xFFFF;
+	// Set flags (zero is kept)
+	bool halfCarry = ((((result - val) & 0xFFF) + (val & 0xFFF)) & 0x1000) == 0x1000;
+	bool carry = (GetHL() + val) > 0xFFFF;
+	m_FlagRegister.set(m_FlagRegister.zero(), false, halfCarry, carry);
 
 	SetHL(result);
 
@@ -590,12 +1456,11 @@ int CPU::ADD_HL_r16(unsigned char reg)
 // Increment value at register r8 by 1
 int CPU::INC_r8(unsigned char reg)
 {
-	unsigned char result = GetR8(reg) + 1;
+	unsigned char value = GetR8(reg);
+	unsigned char result = value + 1;
 	SetR8(reg, result);
 
-	m_FlagRegister.zero = (result == 0);
-	m_FlagRegister.subtract = false;
-	m_FlagRegister.halfCarry = ((((result - 1) & 0xF) + (1 & 0xF)) & 0x10) == 0x10;
+	m_FlagRegister.setIncDec(value, result, false);
 
 	if (reg == 6) return 3;
 	else return 1;
@@ -604,12 +1469,11 @@ int CPU::INC_r8(unsigned char reg)
 // Decrement value at register r8 by 1
 int CPU::DEC_r8(unsigned char reg)
 {
-	unsigned char result = GetR8(reg) - 1;
+	unsigned char value = GetR8(reg);
+	unsigned char result = value - 1;
 	SetR8(reg, result);
 
-	m_FlagRegister.zero = (result == 0);
-	m_FlagRegister.subtract = true;
-	m_FlagRegister.halfCarry = ((((result + 1) & 0xF) - (1 & 0xF)) & 0x10) == 0x10;
+	m_FlagRegister.setIncDec(value, result, true);
 
 	if (reg == 6) return 3;
 	else return 1;
@@ -618,7 +1482,7 @@ int CPU::DEC_r8(unsigned char reg)
 // Copy the immediate value into register r8
 int CPU::LD_r8_imm8(unsigned char reg)
 {
-	unsigned char value = m_Mem->ReadU8(m_PC++);
+	unsigned char value = FetchU8();
 
 	SetR8(reg, value);
 
@@ -629,16 +1493,10 @@ int CPU::LD_r8_imm8(unsigned char reg)
 // Rotate A to the left (circular)
 int CPU::RLCA()
 {
-	bool wasZero = m_Registers.a == 0;
-
-	// Store the right-most byte and add it later to the shifted number
-	unsigned char carryByte = (m_Registers.a & 0b10000000) >> 7;
-	m_Registers.a = m_Registers.a << 1;
-	m_Registers.a |= carryByte;
+	unsigned short result = s_ShiftTable[0][m_Registers.a];
+	m_Registers.a = result;
 
-	m_FlagRegister.reset();
-	m_FlagRegister.zero = m_Registers.a == 0 && !wasZero;
-	m_FlagRegister.carry = carryByte;
+	m_FlagRegister.set(false, false, false, result >> 8);
 
 	return 1;
 }
@@ -646,16 +1504,10 @@ int CPU::RLCA()
 // Rotate A to the right (circular)
 int CPU::RRCA()
 {
-	bool wasZero = m_Registers.a == 0;
-
-	// Store the left-most byte and add it later to the shifted number
-	unsigned char carryByte = (m_Registers.a & 0b00000001);
-	m_Registers.a = m_Registers.a >> 1;
-	m_Registers.a |= (carryByte << 7);
+	unsigned short result = s_ShiftTable[1][m_Registers.a];
+	m_Registers.a = result;
 
-	m_FlagRegister.reset();
-	m_FlagRegister.zero = m_Registers.a == 0 && !wasZero;
-	m_FlagRegister.carry = carryByte;
+	m_FlagRegister.set(false, false, false, result >> 8);
 
 	return 1;
 }
@@ -663,16 +1515,10 @@ int CPU::RRCA()
 // Rotate A to the left THROUGH the carry flag
 int CPU::RLA()
 {
-	bool wasZero = m_Registers.a == 0;
-
-	unsigned char oldCarry = m_FlagRegister.carry;
-	unsigned char carryByte = (m_Registers.a & 0b10000000);
-	m_Registers.a = m_Registers.a << 1;
-	m_Registers.a |= oldCarry;
+	unsigned short result = s_ShiftTable[2][(m_FlagRegister.carry() << 8) | m_Registers.a];
+	m_Registers.a = result;
 
-	m_FlagRegister.reset();
-	//m_FlagRegister.zero = m_Registers.a == 0 && !wasZero;
-	m_FlagRegister.carry = carryByte;
+	m_FlagRegister.set(false, false, false, result >> 8);
 
 	return 1;
 }
@@ -680,14 +1526,10 @@ int CPU::RLA()
 // Rotate A to the right THROUGH the carry flag
 int CPU::RRA()
 {
-	unsigned char oldCarry = m_FlagRegister.carry;
-	unsigned char carryByte = (m_Registers.a & 0b00000001);
-	m_Registers.a = m_Registers.a >> 1;
-	m_Registers.a |= (oldCarry << 7);
+	unsigned short result = s_ShiftTable[3][(m_FlagRegister.carry() << 8) | m_Registers.a];
+	m_Registers.a = result;
 
-	m_FlagRegister.reset();
-	//m_FlagRegister.zero = m_Registers.a == 0;
-	m_FlagRegister.carry = carryByte;
+	m_FlagRegister.set(false, false, false, result >> 8);
 
 	return 1;
 }
@@ -695,28 +1537,11 @@ int CPU::RRA()
 // Decimal adjust A to binary coded decimal
 int CPU::DAA()
 {
-	// Implementation from https://blog.ollien.com/posts/gb-daa/
-	unsigned char a = m_Registers.a;
-	unsigned char offset = 0x00;
-
-	if ((m_FlagRegister.subtract == 0 && (a & 0xF) > 0x09) || m_FlagRegister.halfCarry)
-	{
-		offset |= 0x06;
-	}
-
-	if ((m_FlagRegister.subtract == 0 && a > 0x99) || m_FlagRegister.carry)
-	{
-		offset |= 0x60;
-		m_FlagRegister.carry = true;
-	}
-
-	if (m_FlagRegister.subtract) a -= offset;
-	else a += offset;
-
-	m_Registers.a = a;
+	bool subtract = m_FlagRegister.subtract();
+	unsigned short result = s_DaaTable[(subtract << 10) | (m_FlagRegister.halfCarry() << 9) | (m_FlagRegister.carry() << 8) | m_Registers.a];
+	m_Registers.a = result;
 
-	m_FlagRegister.zero = m_Registers.a == 0;
-	m_FlagRegister.halfCarry = false;
+	m_FlagRegister.setResult(result, subtract);
 
 	return 1;
 }
@@ -726,8 +1551,7 @@ int CPU::CPL()
 {
 	m_Registers.a = ~m_Registers.a;
 
-	m_FlagRegister.subtract = true;
-	m_FlagRegister.halfCarry = true;
+	m_FlagRegister.set(m_FlagRegister.zero(), true, true, m_FlagRegister.carry());
 
 	return 1;
 }
@@ -735,9 +1559,7 @@ int CPU::CPL()
 // Set the carry flag
 int CPU::SCF()
 {
-	m_FlagRegister.subtract = false;
-	m_FlagRegister.halfCarry = false;
-	m_FlagRegister.carry = true;
+	m_FlagRegister.set(m_FlagRegister.zero(), false, false, true);
 
 	return 1;
 }
@@ -745,9 +1567,7 @@ int CPU::SCF()
 // Complement the carry flag
 int CPU::CCF()
 {
-	m_FlagRegister.subtract = false;
-	m_FlagRegister.halfCarry = false;
-	m_FlagRegister.carry = !m_FlagRegister.carry;
+	m_FlagRegister.set(m_FlagRegister.zero(), false, false, !m_FlagRegister.carry());
 
 	return 1;
 }
@@ -755,7 +1575,8 @@ int CPU::CCF()
 // Jump offset
 int CPU::JR_s8()
 {
-	signed char offset = m_Mem->ReadU8(m_PC++);
+	signed char offset = FetchU8();
+	if (offset < 0) JumpBack(m_PC - 2);
 	m_PC += offset;
 
 	return 3;
@@ -764,21 +1585,21 @@ int CPU::JR_s8()
 // Jump conditional
 int CPU::JR_C(unsigned char cond)
 {
-	signed char offset = m_Mem->ReadU8(m_PC++);
+	signed char offset = FetchU8();
 
-	if (cond == 0 && !m_FlagRegister.zero) // Not zero
+	if (cond == 0 && !m_FlagRegister.zero()) // Not zero
 	{
 		m_PC += offset;
 	}
-	else if (cond == 1 && m_FlagRegister.zero) // Zero
+	else if (cond == 1 && m_FlagRegister.zero()) // Zero
 	{
 		m_PC += offset;
 	}
-	else if (cond == 2 && !m_FlagRegister.carry) // No carry
+	else if (cond == 2 && !m_FlagRegister.carry()) // No carry
 	{
 		m_PC += offset;
 	}
-	else if (cond == 3 && m_FlagRegister.carry) // Carry
+	else if (cond == 3 && m_FlagRegister.carry()) // Carry
 	{
 		m_PC += offset;
 	}
@@ -787,6 +1608,8 @@ int CPU::JR_C(unsigned char cond)
 		return 2; // Condition false, 2 machine cycles
 	}
 
+	if (offset < 0) JumpBack(m_PC - offset - 2);
+
 	return 3; // Condition true, 3 machine cycles
 }
 
@@ -813,10 +1636,7 @@ int CPU::HALT()
 	m_Halted = true;
 
 	// Halt bug
-	unsigned char IE = m_Mem->ReadU8(IO::IE);
-	unsigned char IF = m_Mem->ReadU8(IO::IF);
-
-	m_HaltBug = m_IME == 0 && (IE & IF) != 0;
+	m_HaltBug = m_IME == 0 && m_Mem->IsInterruptPending();
 
 	return 1;
 }
@@ -824,13 +1644,10 @@ int CPU::HALT()
 // Add the value at register r8 and A. Stored in A.
 int CPU::ADD_a_r8(unsigned char reg)
 {
-	unsigned char result = m_Registers.a + GetR8(reg);
-
-	m_FlagRegister.zero = result == 0;
-	m_FlagRegister.subtract = false;
-	m_FlagRegister.halfCarry = (((m_Registers.a & 0xF) + (GetR8(reg) & 0xF)) & 0x10) == 0x10;
+	unsigned char value = GetR8(reg);
+	unsigned int result = m_Registers.a + value;
 
-	m_FlagRegister.carry = (m_Registers.a + GetR8(reg)) > 0xFF;
+	m_FlagRegister.setAdd(m_Registers.a, value, result);
 
 	m_Registers.a = result;
 	if (reg == 6) return 2;
@@ -840,14 +1657,10 @@ int CPU::ADD_a_r8(unsigned char reg)
 // Add the value at register r8, A and the carry flag. Stored in A.
 int CPU::ADC_a_r8(unsigned char reg)
 {
-	unsigned char result = m_Registers.a + GetR8(reg) + m_FlagRegister.carry;
-
-	m_FlagRegister.zero = result == 0;
-	m_FlagRegister.subtract = false;
-	m_FlagRegister.halfCarry = (((m_Registers.a & 0xF) + (GetR8(reg) & 0xF) + (m_FlagRegister.carry & 0xF)) & 0x10) == 0x10;
+	unsigned char value = GetR8(reg);
+	unsigned int result = m_Registers.a + value + m_FlagRegister.carry();
 
-	int iImm = GetR8(reg);
-	m_FlagRegister.carry = (m_Registers.a + iImm + m_FlagRegister.carry) > 0xFF;
+	m_FlagRegister.setAdd(m_Registers.a, value, result);
 
 	m_Registers.a = result;
 	if (reg == 6) return 2;
@@ -857,15 +1670,10 @@ int CPU::ADC_a_r8(unsigned char reg)
 // Subtract the value at register r8 from A. Stored in A.
 int CPU::SUB_a_r8(unsigned char reg)
 {
-	m_FlagRegister.carry = m_Registers.a < GetR8(reg);
-
-	unsigned char result = m_Registers.a - GetR8(reg);
+	unsigned char value = GetR8(reg);
+	unsigned int result = m_Registers.a - value;
 
-	m_FlagRegister.zero = result == 0;
-	m_FlagRegister.subtract = true;
-	//m_FlagRegister.halfCarry = ((result & 0x00001000) >> 3) == 0;
-	//m_FlagRegister.carry = ((result & 0x10000000) >> 7) == 0;
-	m_FlagRegister.halfCarry = ((((result + GetR8(reg)) & 0xF) - (GetR8(reg) & 0xF)) & 0x10) == 0x10;
+	m_FlagRegister.setSub(m_Registers.a, value, result);
 
 	m_Registers.a = result;
 	if (reg == 6) return 2;
@@ -875,12 +1683,10 @@ int CPU::SUB_a_r8(unsigned char reg)
 // Subtract the value at register r8, A and the carry flag. Stored in A.
 int CPU::SBC_a_r8(unsigned char reg)
 {
-	unsigned char result = m_Registers.a - GetR8(reg) - m_FlagRegister.carry;
+	unsigned char value = GetR8(reg);
+	unsigned int result = m_Registers.a - value - m_FlagRegister.carry();
 
-	m_FlagRegister.zero = result == 0;
-	m_FlagRegister.subtract = true;
-	m_FlagRegister.halfCarry = (((m_Registers.a & 0xF) - (GetR8(reg) & 0xF) - (m_FlagRegister.carry & 0xF)) & 0x10) == 0x10;
-	m_FlagRegister.carry = m_Registers.a < GetR8(reg) + m_FlagRegister.carry;
+	m_FlagRegister.setSub(m_Registers.a, value, result);
 
 	m_Registers.a = result;
 	if (reg == 6) return 2;
@@ -892,10 +1698,7 @@ int CPU::AND_a_r8(unsigned char reg)
 {
 	m_Registers.a = m_Registers.a & GetR8(reg);
 
-	m_FlagRegister.zero = m_Registers.a == 0;
-	m_FlagRegister.subtract = false;
-	m_FlagRegister.halfCarry = true;
-	m_FlagRegister.carry = false;
+	m_FlagRegister.setLogic(m_Registers.a, true);
 
 	if (reg == 6) return 2;
 	else return 1;
@@ -906,10 +1709,7 @@ int CPU::XOR_a_r8(unsigned char reg)
 {
 	m_Registers.a = m_Registers.a ^ GetR8(reg);
 
-	m_FlagRegister.zero = m_Registers.a == 0;
-	m_FlagRegister.subtract = false;
-	m_FlagRegister.halfCarry = false;
-	m_FlagRegister.carry = false;
+	m_FlagRegister.setLogic(m_Registers.a, false);
 
 	if (reg == 6) return 2;
 	else return 1;
@@ -920,10 +1720,7 @@ int CPU::OR_a_r8(unsigned char reg)
 {
 	m_Registers.a = m_Registers.a | GetR8(reg);
 
-	m_FlagRegister.zero = m_Registers.a == 0;
-	m_FlagRegister.subtract = false;
-	m_FlagRegister.halfCarry = false;
-	m_FlagRegister.carry = false;
+	m_FlagRegister.setLogic(m_Registers.a, false);
 
 	if (reg == 6) return 2;
 	else return 1;
@@ -932,12 +1729,9 @@ int CPU::OR_a_r8(unsigned char reg)
 // Compare the values in A and register r8.
 int CPU::CP_a_r8(unsigned char reg)
 {
-	unsigned char result = m_Registers.a - GetR8(reg);
+	unsigned char value = GetR8(reg);
 
-	m_FlagRegister.zero = result == 0;
-	m_FlagRegister.subtract = true;
-	m_FlagRegister.halfCarry = (((m_Registers.a & 0xF) - (GetR8(reg) & 0xF)) & 0x10) == 0x10;
-	m_FlagRegister.carry = m_Registers.a < GetR8(reg);
+	m_FlagRegister.setSub(m_Registers.a, value, m_Registers.a - value);
 
 	if (reg == 6) return 2;
 	else return 1;
@@ -946,16 +1740,11 @@ int CPU::CP_a_r8(unsigned char reg)
 // Add the immediate value and A. Stored in A.
 int CPU::ADD_a_imm8()
 {
-	unsigned char immediate = m_Mem->ReadU8(m_PC++);
-
-	unsigned char result = m_Registers.a + immediate;
+	unsigned char immediate = FetchU8();
 
-	m_FlagRegister.zero = result == 0;
-	m_FlagRegister.subtract = false;
-	m_FlagRegister.halfCarry = ((((result - immediate) & 0xF) + (immediate & 0xF)) & 0x10) == 0x10;
+	unsigned int result = m_Registers.a + immediate;
 
-	int iImm = immediate;
-	m_FlagRegister.carry = (m_Registers.a + immediate) > 0xFF;
+	m_FlagRegister.setAdd(m_Registers.a, immediate, result);
 
 	m_Registers.a = result;
 	return 2;
@@ -964,16 +1753,11 @@ int CPU::ADD_a_imm8()
 // Add the immediate value, A and the carry flag. Stored in A.
 int CPU::ADC_a_imm8()
 {
-	unsigned char immediate = m_Mem->ReadU8(m_PC++);
+	unsigned char immediate = FetchU8();
 
-	unsigned char result = m_Registers.a + immediate + m_FlagRegister.carry;
+	unsigned int result = m_Registers.a + immediate + m_FlagRegister.carry();
 
-	m_FlagRegister.zero = result == 0;
-	m_FlagRegister.subtract = false;
-	m_FlagRegister.halfCarry = (((m_Registers.a & 0xF) + (immediate & 0xF) + (m_FlagRegister.carry & 0xF)) & 0x10) == 0x10;
-
-	int iImm = immediate;
-	m_FlagRegister.carry = (m_Registers.a + immediate + m_FlagRegister.carry) > 0xFF;
+	m_FlagRegister.setAdd(m_Registers.a, immediate, result);
 
 	m_Registers.a = result;
 	return 2;
@@ -982,16 +1766,13 @@ int CPU::ADC_a_imm8()
 // Subtract the immediate value and A. Stored in A.
 int CPU::SUB_a_imm8()
 {
-	unsigned char immediate = m_Mem->ReadU8(m_PC++);
+	unsigned char immediate = FetchU8();
 
-	m_FlagRegister.carry = m_Registers.a < immediate;
+	unsigned int result = m_Registers.a - immediate;
 
-	unsigned char result = m_Registers.a - immediate;
-	m_Registers.a = result;
+	m_FlagRegister.setSub(m_Registers.a, immediate, result);
 
-	m_FlagRegister.zero = result == 0;
-	m_FlagRegister.subtract = true;
-	m_FlagRegister.halfCarry = ((((result + immediate) & 0xF) - (immediate & 0xF)) & 0x10) == 0x10;
+	m_Registers.a = result;
 
 	return 2;
 }
@@ -999,14 +1780,11 @@ int CPU::SUB_a_imm8()
 // Subtract the immediate value, A and the carry flag. Stored in A.
 int CPU::SBC_a_imm8()
 {
-	unsigned char immediate = m_Mem->ReadU8(m_PC++);
+	unsigned char immediate = FetchU8();
 
-	unsigned char result = m_Registers.a - immediate - m_FlagRegister.carry;
+	unsigned int result = m_Registers.a - immediate - m_FlagRegister.carry();
 
-	m_FlagRegister.zero = result == 0;
-	m_FlagRegister.subtract = true;
-	m_FlagRegister.halfCarry = (((m_Registers.a & 0xF) - (immediate & 0xF) - (m_FlagRegister.carry & 0xF)) & 0x10) == 0x10;
-	m_FlagRegister.carry = m_Registers.a < immediate + m_FlagRegister.carry;
+	m_FlagRegister.setSub(m_Registers.a, immediate, result);
 
 	m_Registers.a = result;
 
@@ -1016,14 +1794,11 @@ int CPU::SBC_a_imm8()
 // Bitwise AND the immediate value and A. Stored in A.
 int CPU::AND_a_imm8()
 {
-	unsigned char immediate = m_Mem->ReadU8(m_PC++);
+	unsigned char immediate = FetchU8();
 
 	m_Registers.a = m_Registers.a & immediate;
 
-	m_FlagRegister.zero = m_Registers.a == 0;
-	m_FlagRegister.subtract = false;
-	m_FlagRegister.halfCarry = true;
-	m_FlagRegister.carry = false;
+	m_FlagRegister.setLogic(m_Registers.a, true);
 
 	return 2;
 }
@@ -1031,14 +1806,11 @@ int CPU::AND_a_imm8()
 // Bitwise XOR the immediate value and A. Stored in A.
 int CPU::XOR_a_imm8()
 {
-	unsigned char immediate = m_Mem->ReadU8(m_PC++);
+	unsigned char immediate = FetchU8();
 
 	m_Registers.a = m_Registers.a ^ immediate;
 
-	m_FlagRegister.zero = m_Registers.a == 0;
-	m_FlagRegister.subtract = false;
-	m_FlagRegister.halfCarry = false;
-	m_FlagRegister.carry = false;
+	m_FlagRegister.setLogic(m_Registers.a, false);
 
 	return 2;
 }
@@ -1046,14 +1818,11 @@ int CPU::XOR_a_imm8()
 // Bitwise OR the immediate value and A. Stored in A.
 int CPU::OR_a_imm8()
 {
-	unsigned char immediate = m_Mem->ReadU8(m_PC++);
+	unsigned char immediate = FetchU8();
 
 	m_Registers.a = m_Registers.a | immediate;
 
-	m_FlagRegister.zero = m_Registers.a == 0;
-	m_FlagRegister.subtract = false;
-	m_FlagRegister.halfCarry = false;
-	m_FlagRegister.carry = false;
+	m_FlagRegister.setLogic(m_Registers.a, false);
 
 	return 2;
 }
@@ -1061,14 +1830,9 @@ int CPU::OR_a_imm8()
 // Compare the immediate value and A.
 int CPU::CP_a_imm8()
 {
-	unsigned char immediate = m_Mem->ReadU8(m_PC++);
-
-	unsigned char result = m_Registers.a - immediate;
+	unsigned char immediate = FetchU8();
 
-	m_FlagRegister.zero = result == 0;
-	m_FlagRegister.subtract = true;
-	m_FlagRegister.halfCarry = (((m_Registers.a & 0xF) - (immediate & 0xF)) & 0x10) == 0x10;
-	m_FlagRegister.carry = m_Registers.a < immediate;
+	m_FlagRegister.setSub(m_Registers.a, immediate, m_Registers.a - immediate);
 
 	return 2;
 }
@@ -1076,42 +1840,38 @@ int CPU::CP_a_imm8()
 // Return conditional.
 int CPU::RET_C(unsigned char cond)
 {
-	unsigned short returnAddress = m_Mem->ReadU16(m_SP++);
-
-	if (cond == 0 && !m_FlagRegister.zero) // Not zero
+	if (cond == 0 && !m_FlagRegister.zero()) // Not zero
 	{
-		m_PC = returnAddress;
-		m_SP++;
+		m_PC = PopU16();
 	}
-	else if (cond == 1 && m_FlagRegister.zero) // Zero
+	else if (cond == 1 && m_FlagRegister.zero()) // Zero
 	{
-		m_PC = returnAddress;
-		m_SP++;
+		m_PC = PopU16();
 	}
-	else if (cond == 2 && !m_FlagRegister.carry) // No carry
+	else if (cond == 2 && !m_FlagRegister.carry()) // No carry
 	{
-		m_PC = returnAddress;
-		m_SP++;
+		m_PC = PopU16();
 	}
-	else if (cond == 3 && m_FlagRegister.carry) // Carry
+	else if (cond == 3 && m_FlagRegister.carry()) // Carry
 	{
-		m_PC = returnAddress;
-		m_SP++;
+		m_PC = PopU16();
 	}
 	else
 	{
-		m_SP--;
 		return 2; // Condition false, 2 machine cycles
 	}
 
+	if (m_GuestProfiler) m_GuestProfiler->Return(m_SP - 2);
+
 	return 5; // Condition true, 5 machine cycles
 }
 
 // Return.
 int CPU::RET()
 {
-	m_PC = m_Mem->ReadU16(m_SP++);
-	m_SP++;
+	if (m_GuestProfiler) m_GuestProfiler->Return(m_SP);
+
+	m_PC = PopU16();
 
 	return 4;
 }
@@ -1128,37 +1888,39 @@ int CPU::RETI()
 // Jump to immediate conditionally.
 int CPU::JP_C_imm16(unsigned char cond)
 {
-	unsigned short jumpAddress = m_Mem->ReadU16(m_PC++);
+	unsigned short branchAddress = m_PC - 1;
+	unsigned short jumpAddress = FetchU16();
 
-	if (cond == 0 && !m_FlagRegister.zero) // Not zero
+	if (cond == 0 && !m_FlagRegister.zero()) // Not zero
 	{
 		m_PC = jumpAddress;
 	}
-	else if (cond == 1 && m_FlagRegister.zero) // Zero
+	else if (cond == 1 && m_FlagRegister.zero()) // Zero
 	{
 		m_PC = jumpAddress;
 	}
-	else if (cond == 2 && !m_FlagRegister.carry) // No carry
+	else if (cond == 2 && !m_FlagRegister.carry()) // No carry
 	{
 		m_PC = jumpAddress;
 	}
-	else if (cond == 3 && m_FlagRegister.carry) // Carry
+	else if (cond == 3 && m_FlagRegister.carry()) // Carry
 	{
 		m_PC = jumpAddress;
 	}
 	else
 	{
-		m_PC++;
 		return 3; // Condition false, 3 machine cycles
 	}
 
+	if (jumpAddress < branchAddress) JumpBack(branchAddress);
+
 	return 4; // Condition true, 4 machine cycles
 }
 
 // Jump to immediate.
 int CPU::JP_imm16()
 {
-	unsigned short jumpAddress = m_Mem->ReadU16(m_PC++);
+	unsigned short jumpAddress = FetchU16();
 	m_PC = jumpAddress;
 
 	return 4;
@@ -1174,19 +1936,19 @@ int CPU::JP_HL()
 // Call function conditionally.
 int CPU::CALL_C_imm16(unsigned char cond)
 {
-	if (cond == 0 && !m_FlagRegister.zero) // Not zero
+	if (cond == 0 && !m_FlagRegister.zero()) // Not zero
 	{
 		CALL_imm16();
 	}
-	else if (cond == 1 && m_FlagRegister.zero) // Zero
+	else if (cond == 1 && m_FlagRegister.zero()) // Zero
 	{
 		CALL_imm16();
 	}
-	else if (cond == 2 && !m_FlagRegister.carry) // No carry
+	else if (cond == 2 && !m_FlagRegister.carry()) // No carry
 	{
 		CALL_imm16();
 	}
-	else if (cond == 3 && m_FlagRegister.carry) // Carry
+	else if (cond == 3 && m_FlagRegister.carry()) // Carry
 	{
 		CALL_imm16();
 	}
@@ -1202,12 +1964,14 @@ int CPU::CALL_C_imm16(unsigned char cond)
 // Call function.
 int CPU::CALL_imm16()
 {
-	unsigned char jumpAddressLsb = m_Mem->ReadU8(m_PC++);
-	unsigned char jumpAddressMsb = m_Mem->ReadU8(m_PC++);
+	unsigned char jumpAddressLsb = FetchU8();
+	unsigned char jumpAddressMsb = FetchU8();
 
 	// Write return address in the stack
-	m_Mem->WriteU16Stack(--m_SP, m_PC);
-	m_SP--; // Adjust for the second write
+	PushU16(m_PC);
+
+	if (m_GuestProfiler) m_GuestProfiler->Call(m_PC, GetBank(m_PC), m_SP);
+
 	m_PC = ((unsigned short)jumpAddressMsb << 8) | jumpAddressLsb;
 
 	return 6;
@@ -1217,8 +1981,9 @@ int CPU::CALL_imm16()
 int CPU::RST_tgt3(unsigned char tgt)
 {
 	// Write return address in the stack
-	m_Mem->WriteU16Stack(--m_SP, m_PC);
-	m_SP--;
+	PushU16(m_PC);
+
+	if (m_GuestProfiler) m_GuestProfiler->Call(m_PC, GetBank(m_PC), m_SP);
 
 	m_PC = tgt * 0x8;
 
@@ -1228,8 +1993,7 @@ int CPU::RST_tgt3(unsigned char tgt)
 // Pop stack to register r16. (Includes AF)
 int CPU::POP_r16(unsigned char reg)
 {
-	unsigned short value = m_Mem->ReadU16(m_SP++);
-	m_SP++;
+	unsigned short value = PopU16();
 
 	switch (reg)
 	{
@@ -1259,24 +2023,22 @@ int CPU::PUSH_r16(unsigned char reg)
 	switch (reg)
 	{
 	case 0:
-		m_Mem->WriteU16Stack(--m_SP, GetBC());
+		PushU16(GetBC());
 		break;
 
 	case 1:
-		m_Mem->WriteU16Stack(--m_SP, GetDE());
+		PushU16(GetDE());
 		break;
 
 	case 2:
-		m_Mem->WriteU16Stack(--m_SP, GetHL());
+		PushU16(GetHL());
 		break;
 
 	case 3:
-		m_Mem->WriteU16Stack(--m_SP, GetAF());
+		PushU16(GetAF());
 		break;
 	}
 
-	m_SP--;
-
 	return 4;
 }
 
@@ -1293,7 +2055,7 @@ int CPU::LDH_c_a()
 // Load from A into address imm8 + 0xFF00.
 int CPU::LDH_imm8_a()
 {
-	unsigned short address = m_Mem->ReadU8(m_PC++) + 0xFF00;
+	unsigned short address = FetchU8() + 0xFF00;
 
 	m_Mem->WriteU8(address, m_Registers.a);
 
@@ -1303,8 +2065,8 @@ int CPU::LDH_imm8_a()
 // Load from A into address imm16.
 int CPU::LD_imm16_a()
 {
-	unsigned char lsb = m_Mem->ReadU8(m_PC++);
-	unsigned char msb = m_Mem->ReadU8(m_PC++);
+	unsigned char lsb = FetchU8();
+	unsigned char msb = FetchU8();
 
 	unsigned short address = ((unsigned short)msb << 8) | lsb;
 
@@ -1327,7 +2089,7 @@ int CPU::LDH_a_c()
 int CPU::LDH_a_imm8()
 {
 	unsigned char offset = 0xFF;
-	unsigned char immediate = m_Mem->ReadU8(m_PC++);
+	unsigned char immediate = FetchU8();
 
 	unsigned short address = ((unsigned short)offset << 8) | immediate;
 	m_Registers.a = m_Mem->ReadU8(address);
@@ -1338,8 +2100,8 @@ int CPU::LDH_a_imm8()
 // Load from address imm16 into register A.
 int CPU::LD_a_imm16()
 {
-	unsigned char lsb = m_Mem->ReadU8(m_PC++);
-	unsigned char msb = m_Mem->ReadU8(m_PC++);
+	unsigned char lsb = FetchU8();
+	unsigned char msb = FetchU8();
 
 	unsigned short address = ((unsigned short)msb << 8) | lsb;
 	m_Registers.a = m_Mem->ReadU8(address);
@@ -1350,14 +2112,13 @@ int CPU::LD_a_imm16()
 // Add to SP a SIGNED immediate.
 int CPU::ADD_SP_imm8()
 {
-	signed char immediate = m_Mem->ReadU8(m_PC++);
+	signed char immediate = FetchU8();
 	unsigned short result = m_SP + immediate;
 	m_SP = result;
 
-	m_FlagRegister.zero = false;
-	m_FlagRegister.subtract = false;
-	m_FlagRegister.halfCarry = (((result - immediate & 0xF) + (immediate & 0xF)) & 0x10) == 0x10;
-	m_FlagRegister.carry = (((result - immediate & 0xFF) + (immediate & 0xFF)) & 0x100) == 0x100;
+	bool halfCarry = (((result - immediate & 0xF) + (immediate & 0xF)) & 0x10) == 0x10;
+	bool carry = (((result - immediate & 0xFF) + (immediate & 0xFF)) & 0x100) == 0x100;
+	m_FlagRegister.set(false, false, halfCarry, carry);
 
 	return 4;
 }
@@ -1365,14 +2126,13 @@ int CPU::ADD_SP_imm8()
 // Add to SP a SIGNED immediate and store it in HL.
 int CPU::LD_HL_SLimm8()
 {
-	signed char immediate = m_Mem->ReadU8(m_PC++);
+	signed char immediate = FetchU8();
 	unsigned short result = m_SP + immediate;
 	SetHL(result);
 
-	m_FlagRegister.zero = false;
-	m_FlagRegister.subtract = false;
-	m_FlagRegister.halfCarry = (((m_SP & 0xF) + (immediate & 0xF)) & 0x10) == 0x10;
-	m_FlagRegister.carry = (((m_SP & 0xFF) + (immediate & 0xFF)) & 0x100) == 0x100;
+	bool halfCarry = (((m_SP & 0xF) + (immediate & 0xF)) & 0x10) == 0x10;
+	bool carry = (((m_SP & 0xFF) + (immediate & 0xFF)) & 0x100) == 0x100;
+	m_FlagRegister.set(false, false, halfCarry, carry);
 
 	return 3;
 }
@@ -1398,159 +2158,64 @@ int CPU::EI()
 	return 1;
 }
 
-// Rotate register r8 to the left (circular)
-int CPU::RLC_r8(unsigned char reg)
+// Rotate or shift register r8, the result & carry come from s_ShiftTable
+int CPU::ShiftR8(unsigned char reg, unsigned char operation)
 {
-	unsigned char value = GetR8(reg);
-
-	// Store the right-most byte and add it later to the shifted number
-	unsigned char carryByte = (value & 0b10000000) >> 7;
-	value = value << 1;
-	value |= carryByte;
-
-	SetR8(reg, value);
+	unsigned short result = s_ShiftTable[operation][(m_FlagRegister.carry() << 8) | GetR8(reg)];
+	SetR8(reg, result & 0xFF);
 
-	m_FlagRegister.reset();
-	m_FlagRegister.zero = value == 0;
-	m_FlagRegister.carry = carryByte;
+	m_FlagRegister.setResult(result, false);
 
 	if (reg == 6) return 4;
 	else return 2;
 }
 
+// Rotate register r8 to the left (circular)
+int CPU::RLC_r8(unsigned char reg)
+{
+	return ShiftR8(reg, 0);
+}
+
 // Rotate register r8 to the right (circular)
 int CPU::RRC_r8(unsigned char reg)
 {
-	unsigned char value = GetR8(reg);
-
-	// Store the right-most byte and add it later to the shifted number
-	unsigned char carryByte = (value & 0b00000001);
-	value = value >> 1;
-	value |= (carryByte << 7);
-
-	SetR8(reg, value);
-
-	m_FlagRegister.reset();
-	m_FlagRegister.zero = value == 0;
-	m_FlagRegister.carry = carryByte;
-
-	if (reg == 6) return 4;
-	else return 2;
+	return ShiftR8(reg, 1);
 }
 
 // Rotate register r8 to the left THROUGH the carry flag
 int CPU::RL_r8(unsigned char reg)
 {
-	unsigned char value = GetR8(reg);
-
-	unsigned char oldCarry = m_FlagRegister.carry;
-	unsigned char carryByte = (value & 0b10000000);
-	value = value << 1;
-	value |= oldCarry;
-
-	SetR8(reg, value);
-
-	m_FlagRegister.reset();
-	m_FlagRegister.zero = value == 0;
-	m_FlagRegister.carry = carryByte;
-
-	if (reg == 6) return 4;
-	else return 2;
+	return ShiftR8(reg, 2);
 }
 
 // Rotate register r8 to the right THROUGH the carry flag
 int CPU::RR_r8(unsigned char reg)
 {
-	unsigned char value = GetR8(reg);
-
-	unsigned char oldCarry = m_FlagRegister.carry;
-	unsigned char carryByte = (value & 0b00000001);
-	value = value >> 1;
-	value |= (oldCarry << 7);
-
-	SetR8(reg, value);
-
-	m_FlagRegister.reset();
-	m_FlagRegister.zero = value == 0;
-	m_FlagRegister.carry = carryByte;
-
-	if (reg == 6) return 4;
-	else return 2;
+	return ShiftR8(reg, 3);
 }
 
 // Shift register r8 to the left (arithmetically)
 int CPU::SLA_r8(unsigned char reg)
 {
-	unsigned char value = GetR8(reg);
-
-	unsigned char carryByte = (value & 0b10000000);
-	value = value << 1;
-
-	SetR8(reg, value);
-
-	m_FlagRegister.reset();
-	m_FlagRegister.zero = value == 0;
-	m_FlagRegister.carry = carryByte;
-
-	if (reg == 6) return 4;
-	else return 2;
+	return ShiftR8(reg, 4);
 }
 
 // Shift register r8 to the right (arithmetically)
 int CPU::SRA_r8(unsigned char reg)
 {
-	unsigned char value = GetR8(reg);
-
-	bool upperByte = value & 0b10000000;
-	bool carryByte = value & 0b00000001;
-	value = value >> 1;
-	value |= upperByte << 7;
-
-	SetR8(reg, value);
-
-	m_FlagRegister.reset();
-	m_FlagRegister.zero = value == 0;
-	m_FlagRegister.carry = carryByte;
-
-	if (reg == 6) return 4;
-	else return 2;
+	return ShiftR8(reg, 5);
 }
 
 // Swap the upper 4 bits with the lower 4 bits of register r8
 int CPU::SWAP_r8(unsigned char reg)
 {
-	unsigned char value = GetR8(reg);
-
-	unsigned char lower = value & 0b00001111;
-	unsigned char upper = value & 0b11110000;
-
-	value = (lower << 4) | (upper >> 4);
-	SetR8(reg, value);
-
-	m_FlagRegister.reset();
-	m_FlagRegister.zero = value == 0;
-
-	if (reg == 6) return 4;
-	else return 2;
+	return ShiftR8(reg, 6);
 }
 
 // Shift register r8 to the right (logically)
 int CPU::SRL_r8(unsigned char reg)
 {
-	unsigned char value = GetR8(reg);
-
-	bool carryByte = value & 0b00000001;
-	value = value >> 1;
-	value &= 0b01111111; // Mask out the upper bit (set to 0)
-
-	SetR8(reg, value);
-
-	m_FlagRegister.reset();
-	m_FlagRegister.zero = value == 0;
-	m_FlagRegister.carry = carryByte;
-
-	if (reg == 6) return 4;
-	else return 2;
+	return ShiftR8(reg, 7);
 }
 
 // Test bit b in register r8, set Z if bit is zero
@@ -1560,9 +2225,7 @@ int CPU::BIT(unsigned char bit, unsigned char reg)
 
 	bool bitSet = (GetR8(reg) & mask) >> bit;
 
-	m_FlagRegister.zero = !bitSet;
-	m_FlagRegister.subtract = false;
-	m_FlagRegister.halfCarry = true;
+	m_FlagRegister.set(!bitSet, false, true, m_FlagRegister.carry());
 
 	if (reg == 6) return 3;
 	else return 2;
@@ -0,0 +1,362 @@
+#include "CPU.h"
+
+#ifdef BITDMG_JIT
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "Jit.h"
+#include "Log.h"
+
+using X86 = X86Emitter;
+
+void CPU::CompileBlock(Block &block)
+{
+	if (!m_Jit)
+	{
+		m_Jit = std::make_shared<Jit>();
+		m_Jit->SetVerify(m_JitVerify);
+	}
+
+	if (!m_Jit->IsValid()) return;
+
+	const int pending = offsetof(JitContext, pending);
+	const int elapsed = offsetof(JitContext, elapsed);
+	const int budget = offsetof(JitContext, budget);
+	const int pc = (int)((const char *)&m_PC - (const char *)this);
+	const int instructionCount = (int)((const char *)&m_InstructionCount - (const char *)this);
+	const bool verify = m_Jit->IsVerifying();
+
+	X86 x86;
+	std::vector<size_t> exits;
+	std::vector<std::pair<size_t, unsigned short>> budgetExits;
+	bool anyNative = false;
+
+	// push rbx; push rbp; sub rsp, 8; mov rbx, rdi; mov rbp, rsi (rbx = CPU, rbp = context, stack aligned for calls)
+	x86.Bytes({0x53, 0x55, 0x48, 0x83, 0xEC, 0x08, 0x48, 0x89, 0xFB, 0x48, 0x89, 0xF5});
+
+	bool previousNative = false;
+	for (size_t i = 0; i < block.opcodes.size(); i++)
+	{
+		const DecodedOpcode &decoded = block.opcodes[i];
+		const unsigned char *operands = block.bytes.data() + (decoded.address + decoded.operandOffset - block.start);
+
+		// A native opcode ran since RunBlocks or JitExecute checked interrupts, it can't change them but the budget still runs out
+		if (previousNative)
+		{
+			x86.LoadDword(X86::EAX, X86::EBP, elapsed);
+			x86.CompareDword(X86::EAX, X86::EBP, budget);
+			budgetExits.push_back({x86.Jump(0x8D), decoded.address});
+		}
+
+		X86 native;
+		int cycles = 0;
+		if (EmitNative(native, decoded, operands, cycles))
+		{
+			if (verify)
+			{
+				// mov rdi, rbx; mov rsi, rbp
+				x86.Bytes({0x48, 0x89, 0xDF, 0x48, 0x89, 0xEE});
+				x86.Call((const void *)&CPU::JitVerifyBegin);
+			}
+
+			x86.code.insert(x86.code.end(), native.code.begin(), native.code.end());
+			x86.AddDwordImm(X86::EBP, elapsed, cycles);
+			x86.AddDwordImm(X86::EBP, pending, cycles);
+			x86.AddQwordImm(X86::EBX, instructionCount, 1);
+
+			if (verify)
+			{
+				// mov rdi, rbx; mov rsi, rbp; mov rdx, block; mov ecx, index; mov r8d, cycles
+				x86.Bytes({0x48, 0x89, 0xDF, 0x48, 0x89, 0xEE, 0x48, 0xBA});
+				x86.Imm64((unsigned long long)&block);
+				x86.MovImm(X86::ECX, (unsigned int)i);
+				x86.Bytes({0x41, 0xB8});
+				x86.Imm32(cycles);
+				x86.Call((const void *)&CPU::JitVerifyEnd);
+			}
+
+			anyNative = true;
+			previousNative = true;
+		}
+		else
+		{
+			// mov rdi, rbx; mov rsi, block; mov edx, index; mov rcx, rbp
+			x86.Bytes({0x48, 0x89, 0xDF, 0x48, 0xBE});
+			x86.Imm64((unsigned long long)&block);
+			x86.MovImm(X86::EDX, (unsigned int)i);
+			x86.Bytes({0x48, 0x89, 0xE9});
+			x86.Call((const void *)&CPU::JitExecute);
+
+			// test eax, eax; jnz exit
+			x86.Bytes({0x85, 0xC0});
+			exits.push_back(x86.Jump(0x85));
+
+			previousNative = false;
+		}
+	}
+
+	// Nothing to gain from a block that only calls handlers, it stays interpreted
+	if (!anyNative) return;
+
+	// End of the block, PC wasn't updated by the native opcodes
+	if (previousNative) x86.StoreWordImm(X86::EBX, pc, block.end);
+	x86.MovImm(X86::EAX, JIT_CONTINUE);
+	exits.push_back(x86.Jump(0));
+
+	// Budget ran out before a native opcode
+	for (auto &[displacement, address] : budgetExits)
+	{
+		x86.Patch(displacement, x86.code.size());
+		x86.StoreWordImm(X86::EBX, pc, address);
+		x86.MovImm(X86::EAX, JIT_CONTINUE);
+		exits.push_back(x86.Jump(0));
+	}
+
+	// add rsp, 8; pop rbp; pop rbx; ret
+	for (size_t displacement : exits) x86.Patch(displacement, x86.code.size());
+	x86.Bytes({0x48, 0x83, 0xC4, 0x08, 0x5D, 0x5B, 0xC3});
+
+	void *code = m_Jit->Add(x86.code);
+	if (code == nullptr)
+	{
+		// Out of executable memory, start over (no native block is running while compiling), hot blocks get compiled again once they warm up
+		for (auto &[key, cached] : m_Blocks)
+		{
+			cached.native = nullptr;
+			cached.runs = 0;
+		}
+		m_Jit->Reset();
+		code = m_Jit->Add(x86.code);
+	}
+
+	block.native = (JitFunction)code;
+}
+
+bool CPU::EmitNative(X86Emitter &x86, const DecodedOpcode &decoded, const unsigned char *operands, int &cycles)
+{
+	const int registers = (int)((const char *)&m_Registers - (const char *)this);
+	const int sp = (int)((const char *)&m_SP - (const char *)this);
+	const int flags = (int)((const char *)&m_FlagRegister - (const char *)this);
+	const int result = flags + offsetof(FlagRegister, result);
+	const int xorOperands = flags + offsetof(FlagRegister, operands);
+	const int subtractOp = flags + offsetof(FlagRegister, subtractOp);
+	const int a = registers + (7 ^ R8_INDEX_SWAP);
+
+	auto r8 = [&](int reg) { return registers + (reg ^ R8_INDEX_SWAP); };
+	auto r16 = [&](int reg) { return reg == 3 ? sp : registers + reg * 2; };
+
+	// Zero flag bit of FlagRegister::set from the current result: ecx = (eax & 0xFF) != 0
+	auto zeroBit = [&]()
+	{
+		x86.MovzxWord(X86::EAX, X86::EBX, result);
+		x86.Bytes({0x84, 0xC0, 0x0F, 0x95, 0xC1, 0x0F, 0xB6, 0xC9}); // test al, al; setne cl; movzx ecx, cl
+	};
+
+	unsigned char opcode = decoded.opcode;
+	unsigned char y = (opcode >> 3) & 0x07;
+	unsigned char z = opcode & 0x07;
+	unsigned char p = y >> 1;
+
+	// NOP
+	if (opcode == 0x00)
+	{
+		cycles = 1;
+		return true;
+	}
+
+	// LD r16, imm16
+	if ((opcode & 0xCF) == 0x01)
+	{
+		x86.StoreWordImm(X86::EBX, r16(p), operands[0] | (operands[1] << 8));
+		cycles = 3;
+		return true;
+	}
+
+	// INC r16, DEC r16
+	if ((opcode & 0xC7) == 0x03)
+	{
+		x86.IncDecWord(X86::EBX, r16(p), opcode & 0x08);
+		cycles = 2;
+		return true;
+	}
+
+	// INC r8, DEC r8
+	if ((opcode & 0xC6) == 0x04 && y != 6)
+	{
+		bool decrement = z == 5;
+
+		x86.MovzxByte(X86::EAX, X86::EBX, r8(y));
+		x86.RegOp(0x89, X86::ECX, X86::EAX);
+		x86.Bytes({0xFF, (unsigned char)(decrement ? 0xC9 : 0xC1)}); // inc/dec ecx
+		x86.StoreByte(X86::EBX, r8(y), X86::ECX);
+
+		// setIncDec
+		x86.MovzxWord(X86::EDX, X86::EBX, result);
+		x86.RegOpImm(4, X86::EDX, 0x100);
+		x86.Bytes({0x0F, 0xB6, 0xC9}); // movzx ecx, cl
+		x86.RegOp(0x09, X86::EDX, X86::ECX);
+		x86.StoreWord(X86::EBX, result, X86::EDX);
+		x86.RegOpImm(6, X86::EAX, 0x01);
+		x86.StoreByte(X86::EBX, xorOperands, X86::EAX);
+		x86.StoreByteImm(X86::EBX, subtractOp, decrement);
+
+		cycles = 1;
+		return true;
+	}
+
+	// LD r8, imm8
+	if ((opcode & 0xC7) == 0x06 && y != 6)
+	{
+		x86.StoreByteImm(X86::EBX, r8(y), operands[0]);
+		cycles = 2;
+		return true;
+	}
+
+	// CPL, SCF, CCF
+	if (opcode == 0x2F)
+	{
+		x86.MovzxByte(X86::EAX, X86::EBX, a);
+		x86.Bytes({0xF7, 0xD0}); // not eax
+		x86.StoreByte(X86::EBX, a, X86::EAX);
+
+		zeroBit();
+		x86.RegOpImm(4, X86::EAX, 0x100);
+		x86.RegOp(0x09, X86::EAX, X86::ECX);
+		x86.StoreWord(X86::EBX, result, X86::EAX);
+		x86.StoreByteImm(X86::EBX, xorOperands, 0x10);
+		x86.StoreByteImm(X86::EBX, subtractOp, 1);
+
+		cycles = 1;
+		return true;
+	}
+
+	if (opcode == 0x37 || opcode == 0x3F)
+	{
+		zeroBit();
+		if (opcode == 0x37)
+		{
+			x86.RegOpImm(1, X86::ECX, 0x100);
+			x86.StoreWord(X86::EBX, result, X86::ECX);
+		}
+		else
+		{
+			x86.RegOpImm(4, X86::EAX, 0x100);
+			x86.RegOpImm(6, X86::EAX, 0x100);
+			x86.RegOp(0x09, X86::EAX, X86::ECX);
+			x86.StoreWord(X86::EBX, result, X86::EAX);
+		}
+		x86.StoreByteImm(X86::EBX, xorOperands, 0x00);
+		x86.StoreByteImm(X86::EBX, subtractOp, 0);
+
+		cycles = 1;
+		return true;
+	}
+
+	// LD r8, r8 (not HALT)
+	if (opcode >= 0x40 && opcode <= 0x7F && y != 6 && z != 6)
+	{
+		x86.MovzxByte(X86::EAX, X86::EBX, r8(z));
+		x86.StoreByte(X86::EBX, r8(y), X86::EAX);
+		cycles = 1;
+		return true;
+	}
+
+	// ALU A, r8 & ALU A, imm8
+	bool immediate = (opcode & 0xC7) == 0xC6;
+	if (!((opcode >= 0x80 && opcode <= 0xBF && z != 6) || immediate)) return false;
+
+	x86.MovzxByte(X86::EAX, X86::EBX, a);
+	if (immediate) x86.MovImm(X86::ECX, operands[0]);
+	else x86.MovzxByte(X86::ECX, X86::EBX, r8(z));
+
+	switch (y)
+	{
+	// ADD, ADC, SUB, SBC, CP
+	case 0: case 1: case 2: case 3: case 7:
+	{
+		bool subtract = y >= 2;
+
+		x86.RegOp(0x89, X86::EDX, X86::EAX);
+		x86.RegOp(subtract ? 0x29 : 0x01, X86::EDX, X86::ECX);
+
+		if (y == 1 || y == 3)
+		{
+			// Carry in: (result >> 8) & 1
+			x86.MovzxWord(X86::ESI, X86::EBX, result);
+			x86.Bytes({0xC1, 0xEE, 0x08, 0x83, 0xE6, 0x01}); // shr esi, 8; and esi, 1
+			x86.RegOp(subtract ? 0x29 : 0x01, X86::EDX, X86::ESI);
+		}
+
+		if (subtract) x86.RegOpImm(4, X86::EDX, 0x1FF);
+
+		x86.StoreWord(X86::EBX, result, X86::EDX);
+		x86.RegOp(0x31, X86::EAX, X86::ECX);
+		x86.StoreByte(X86::EBX, xorOperands, X86::EAX);
+		x86.StoreByteImm(X86::EBX, subtractOp, subtract);
+		if (y != 7) x86.StoreByte(X86::EBX, a, X86::EDX);
+		break;
+	}
+
+	// AND, XOR, OR
+	default:
+		x86.RegOp(y == 4 ? 0x21 : (y == 5 ? 0x31 : 0x09), X86::EAX, X86::ECX);
+		x86.StoreByte(X86::EBX, a, X86::EAX);
+		x86.StoreWord(X86::EBX, result, X86::EAX);
+		if (y == 4) x86.RegOpImm(6, X86::EAX, 0x10);
+		x86.StoreByte(X86::EBX, xorOperands, X86::EAX);
+		x86.StoreByteImm(X86::EBX, subtractOp, 0);
+		break;
+	}
+
+	cycles = immediate ? 2 : 1;
+	return true;
+}
+
+void CPU::JitVerifyBegin(CPU *cpu, JitContext *context)
+{
+	context->registers = cpu->m_Registers;
+	context->flags = cpu->m_FlagRegister;
+	context->sp = cpu->m_SP;
+}
+
+void CPU::JitVerifyEnd(CPU *cpu, JitContext *context, Block *block, int index, int cycles)
+{
+	const DecodedOpcode &decoded = block->opcodes[index];
+	unsigned short next = (size_t)index + 1 < block->opcodes.size() ? block->opcodes[index + 1].address : block->end;
+
+	Registers nativeRegisters = cpu->m_Registers;
+	FlagRegister nativeFlags = cpu->m_FlagRegister;
+	unsigned short nativeSP = cpu->m_SP;
+
+	// Register only opcodes, running them again from the saved state has no side effect
+	cpu->m_Registers = context->registers;
+	cpu->m_FlagRegister = context->flags;
+	cpu->m_SP = context->sp;
+
+	cpu->m_PC = decoded.address + decoded.operandOffset;
+	cpu->m_Operands = block->bytes.data() + (cpu->m_PC - block->start);
+	int interpreterCycles = (cpu->*decoded.handler)(decoded.x, decoded.y);
+	cpu->m_Operands = nullptr;
+
+	bool match = std::memcmp(nativeRegisters.r16, cpu->m_Registers.r16, sizeof(nativeRegisters.r16)) == 0 &&
+				 nativeFlags.result == cpu->m_FlagRegister.result && nativeFlags.operands == cpu->m_FlagRegister.operands &&
+				 nativeFlags.subtractOp == cpu->m_FlagRegister.subtractOp && nativeSP == cpu->m_SP && cycles == interpreterCycles &&
+				 cpu->m_PC == next;
+
+	cpu->m_Jit->CountVerified(match);
+	if (match) return;
+
+	// Keep the interpreter state so the emulation stays correct
+	char txt[192];
+	std::snprintf(txt, sizeof(txt), "Native opcode %02X at %04X differs: AF %02X%02X/%02X%02X (lazy %03X,%02X/%03X,%02X) BC %04X/%04X DE %04X/%04X HL %04X/%04X SP %04X/%04X cycles %d/%d (native/interpreter)",
+				  decoded.opcode, decoded.address, nativeRegisters.a, nativeFlags.toU8(), cpu->m_Registers.a, cpu->m_FlagRegister.toU8(),
+				  nativeFlags.result, nativeFlags.operands, cpu->m_FlagRegister.result, cpu->m_FlagRegister.operands,
+				  nativeRegisters.bc, cpu->m_Registers.bc, nativeRegisters.de, cpu->m_Registers.de, nativeRegisters.hl, cpu->m_Registers.hl,
+				  nativeSP, cpu->m_SP, cycles, interpreterCycles);
+	Log::LogError(txt);
+}
+
+#endif
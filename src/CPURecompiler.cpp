@@ -0,0 +1,305 @@
+#include "CPU.h"
+
+#ifdef BITDMG_STATIC_RECOMPILER
+
+#include <cstdarg>
+#include <cstdio>
+#include <map>
+#include <set>
+#include <string>
+
+#include "Log.h"
+
+// Bound on the translated blocks so ROMs full of data decoding as code stay buildable
+static constexpr size_t MAX_RECOMPILED_BLOCKS = 1 << 16;
+
+/* Append printf formatted text.
+ * @param code Output string.
+ * @param format printf format.
+ */
+static void AppendFormat(std::string &code, const char *format, ...)
+{
+	char buffer[256];
+
+	va_list args;
+	va_start(args, format);
+	std::vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+
+	code += buffer;
+}
+
+std::string CPU::Recompile(Cartridge &cartridge)
+{
+	// Banks that can be mapped at 0x4000-0x7FFF, blocks are keyed like GetBank (1 without a mapper)
+	std::vector<unsigned int> banks;
+	int selectable = cartridge.GetMapper() == Mapper::MBC1 ? 32 : (cartridge.GetMapper() == Mapper::MBC2 ? 16 : 2);
+	for (int bank = 1; bank < selectable && bank < cartridge.GetRomBankCount(); bank++)
+	{
+		banks.push_back(bank);
+	}
+
+	std::set<unsigned int> seen;
+	std::vector<unsigned int> work;
+
+	auto push = [&](unsigned int bank, unsigned int address)
+	{
+		unsigned int key = (bank << 16) | address;
+		if (seen.insert(key).second) work.push_back(key);
+	};
+
+	// The bank of a switchable address is only known when jumping within that bank, otherwise try all of them
+	auto pushTarget = [&](unsigned int fromBank, unsigned int address)
+	{
+		address &= 0xFFFF;
+		if (address <= 0x3FFF) push(0, address);
+		else if (address <= 0x7FFF && fromBank != 0) push(fromBank, address);
+		else if (address <= 0x7FFF)
+		{
+			for (unsigned int bank : banks) push(bank, address);
+		}
+	};
+
+	// Entry point, RST & interrupt vectors
+	pushTarget(0, 0x0100);
+	for (unsigned int vector = 0x00; vector <= 0x60; vector += 0x08)
+	{
+		pushTarget(0, vector);
+	}
+
+	std::map<unsigned int, Block> blocks;
+	while (!work.empty() && blocks.size() < MAX_RECOMPILED_BLOCKS)
+	{
+		unsigned int key = work.back();
+		work.pop_back();
+
+		unsigned int bank = key >> 16;
+		unsigned short start = key & 0xFFFF;
+
+		Block block;
+		if (!DecodeBlock(start, block, [&](unsigned short address) { return cartridge.ReadBankedU8(bank, address); })) continue;
+
+		// Follow branches, calls & the code after them
+		for (const DecodedOpcode &decoded : block.opcodes)
+		{
+			const unsigned char *operands = block.bytes.data() + (decoded.address + 1 - block.start);
+			unsigned int next = decoded.address + GetOpcodeLength(decoded.opcode);
+
+			switch (decoded.opcode)
+			{
+			case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: // JR (cond)
+				pushTarget(bank, next + (signed char)operands[0]);
+				break;
+
+			case 0xC3: case 0xC2: case 0xCA: case 0xD2: case 0xDA: // JP (cond)
+				pushTarget(bank, operands[0] | (operands[1] << 8));
+				break;
+
+			case 0xCD: case 0xC4: case 0xCC: case 0xD4: case 0xDC: // CALL (cond)
+				pushTarget(bank, operands[0] | (operands[1] << 8));
+				pushTarget(bank, next);
+				break;
+
+			case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF: // RST
+				pushTarget(bank, decoded.opcode & 0x38);
+				pushTarget(bank, next);
+				break;
+
+			case 0x76: case 0x10: // HALT, STOP
+				pushTarget(bank, next);
+				break;
+			}
+		}
+
+		if (!EndsBlock(block.opcodes.back().opcode)) pushTarget(bank, block.end);
+
+		blocks.emplace(key, std::move(block));
+	}
+
+	std::string code;
+	AppendFormat(code, "// %s (CRC-32 %08X) translated by BitDMG, cached under the hash of this file so it's regenerated whenever the translation changes\n",
+				 cartridge.GetCartName().c_str(), cartridge.GetChecksum());
+	code += RecompiledModule::INTERFACE_SOURCE;
+	code += "\n\n";
+
+	std::string table;
+	size_t translated = 0;
+
+	for (auto &[key, block] : blocks)
+	{
+		std::string body;
+		bool anyNative = false;
+		bool previousNative = false;
+
+		for (size_t i = 0; i < block.opcodes.size(); i++)
+		{
+			const DecodedOpcode &decoded = block.opcodes[i];
+			const unsigned char *operands = block.bytes.data() + (decoded.address + decoded.operandOffset - block.start);
+
+			// A native opcode ran since the last check, the budget may have run out
+			if (previousNative) AppendFormat(body, "\tif (s->elapsed >= s->budget) { *s->pc = 0x%04X; return %d; }\n", decoded.address, JIT_CONTINUE);
+
+			AppendFormat(body, "\t// %04X: %02X\n", decoded.address, decoded.opcode == 0xCB ? 0xCB00 | operands[-1] : decoded.opcode);
+
+			int cycles = 0;
+			if (EmitRecompiled(body, decoded, operands, cycles))
+			{
+				AppendFormat(body, "\ts->elapsed += %d; s->pending += %d; (*s->instructionCount)++;\n", cycles, cycles);
+				anyNative = true;
+				previousNative = true;
+			}
+			else
+			{
+				AppendFormat(body, "\tif (int status = s->execute(s, %d)) return status;\n", (int)i);
+				previousNative = false;
+			}
+		}
+
+		// Blocks without register only opcodes run as fast in the interpreter
+		if (!anyNative) continue;
+
+		if (previousNative) AppendFormat(body, "\t*s->pc = 0x%04X;\n", block.end);
+		AppendFormat(body, "\treturn %d;\n", JIT_CONTINUE);
+
+		AppendFormat(code, "static int Block_%02X_%04X(RecompiledState *s)\n{\n", key >> 16, key & 0xFFFF);
+		code += body;
+		code += "}\n\n";
+
+		AppendFormat(table, "\t{0x%06X, 0x%04X, %d, Block_%02X_%04X},\n", key, block.end, (int)block.opcodes.size(), key >> 16, key & 0xFFFF);
+		translated++;
+	}
+
+	AppendFormat(code, "extern \"C\" const unsigned int bitdmg_abi = %d;\n", BITDMG_RECOMPILED_ABI);
+	AppendFormat(code, "extern \"C\" const unsigned int bitdmg_block_count = %d;\n", (int)translated);
+	code += "extern \"C\" const RecompiledBlock bitdmg_blocks[] = {\n" + table + "\t{0, 0, 0, nullptr}};\n";
+
+	std::string logTxt = "Translated " + std::to_string(translated) + " of " + std::to_string(blocks.size()) + " reachable blocks";
+	Log::LogInfo(logTxt.c_str());
+	return code;
+}
+
+bool CPU::EmitRecompiled(std::string &code, const DecodedOpcode &decoded, const unsigned char *operands, int &cycles)
+{
+	const int a = 7 ^ R8_INDEX_SWAP;
+	auto r8 = [](int reg) { return reg ^ R8_INDEX_SWAP; };
+
+	// FlagRegister::set with the current zero flag
+	const char *zeroBit = "((*s->flagResult & 0xFF) != 0)";
+
+	unsigned char opcode = decoded.opcode;
+	unsigned char y = (opcode >> 3) & 0x07;
+	unsigned char z = opcode & 0x07;
+	unsigned char p = y >> 1;
+
+	// NOP
+	if (opcode == 0x00)
+	{
+		cycles = 1;
+		return true;
+	}
+
+	// LD r16, imm16
+	if ((opcode & 0xCF) == 0x01)
+	{
+		if (p == 3) AppendFormat(code, "\t*s->sp = 0x%04X;\n", operands[0] | (operands[1] << 8));
+		else AppendFormat(code, "\ts->r16[%d] = 0x%04X;\n", p, operands[0] | (operands[1] << 8));
+		cycles = 3;
+		return true;
+	}
+
+	// INC r16, DEC r16
+	if ((opcode & 0xC7) == 0x03)
+	{
+		const char *change = (opcode & 0x08) ? "--" : "++";
+		if (p == 3) AppendFormat(code, "\t(*s->sp)%s;\n", change);
+		else AppendFormat(code, "\ts->r16[%d]%s;\n", p, change);
+		cycles = 2;
+		return true;
+	}
+
+	// INC r8, DEC r8
+	if ((opcode & 0xC6) == 0x04 && y != 6)
+	{
+		bool decrement = z == 5;
+		AppendFormat(code, "\t{ unsigned char v = s->r8[%d]; unsigned char r = v %c 1; s->r8[%d] = r; "
+						   "*s->flagResult = (*s->flagResult & 0x100) | r; *s->flagOperands = v ^ 0x01; *s->flagSubtract = %s; }\n",
+					 r8(y), decrement ? '-' : '+', r8(y), decrement ? "true" : "false");
+		cycles = 1;
+		return true;
+	}
+
+	// LD r8, imm8
+	if ((opcode & 0xC7) == 0x06 && y != 6)
+	{
+		AppendFormat(code, "\ts->r8[%d] = 0x%02X;\n", r8(y), operands[0]);
+		cycles = 2;
+		return true;
+	}
+
+	// CPL, SCF, CCF
+	if (opcode == 0x2F)
+	{
+		AppendFormat(code, "\ts->r8[%d] = ~s->r8[%d]; *s->flagResult = %s | (*s->flagResult & 0x100); *s->flagOperands = 0x10; *s->flagSubtract = true;\n", a, a, zeroBit);
+		cycles = 1;
+		return true;
+	}
+
+	if (opcode == 0x37 || opcode == 0x3F)
+	{
+		AppendFormat(code, "\t*s->flagResult = %s | %s; *s->flagOperands = 0x00; *s->flagSubtract = false;\n", zeroBit,
+					 opcode == 0x37 ? "0x100" : "((*s->flagResult & 0x100) ^ 0x100)");
+		cycles = 1;
+		return true;
+	}
+
+	// LD r8, r8 (not HALT)
+	if (opcode >= 0x40 && opcode <= 0x7F && y != 6 && z != 6)
+	{
+		AppendFormat(code, "\ts->r8[%d] = s->r8[%d];\n", r8(y), r8(z));
+		cycles = 1;
+		return true;
+	}
+
+	// ALU A, r8 & ALU A, imm8
+	bool immediate = (opcode & 0xC7) == 0xC6;
+	if (!((opcode >= 0x80 && opcode <= 0xBF && z != 6) || immediate)) return false;
+
+	std::string value = immediate ? std::to_string(operands[0]) : "s->r8[" + std::to_string(r8(z)) + "]";
+	AppendFormat(code, "\t{ unsigned char a = s->r8[%d]; unsigned char v = %s; ", a, value.c_str());
+
+	switch (y)
+	{
+	case 0: code += "unsigned int r = a + v; "; break;
+	case 1: code += "unsigned int r = a + v + ((*s->flagResult >> 8) & 1); "; break;
+	case 2: case 7: code += "unsigned int r = (a - v) & 0x1FF; "; break;
+	case 3: code += "unsigned int r = (a - v - ((*s->flagResult >> 8) & 1)) & 0x1FF; "; break;
+	case 4: code += "unsigned char r = a & v; "; break;
+	case 5: code += "unsigned char r = a ^ v; "; break;
+	case 6: code += "unsigned char r = a | v; "; break;
+	}
+
+	if (y <= 3 || y == 7) AppendFormat(code, "*s->flagResult = r; *s->flagOperands = a ^ v; *s->flagSubtract = %s; ", (y >= 2) ? "true" : "false");
+	else AppendFormat(code, "*s->flagResult = r; *s->flagOperands = r ^ %s; *s->flagSubtract = false; ", y == 4 ? "0x10" : "0x00");
+
+	if (y != 7) AppendFormat(code, "s->r8[%d] = r; ", a);
+	code += "}\n";
+
+	cycles = immediate ? 2 : 1;
+	return true;
+}
+
+int CPU::RecompiledExecute(RecompiledState *state, int index)
+{
+	JitContext context;
+	context.budget = state->budget;
+	context.elapsed = state->elapsed;
+	context.pending = state->pending;
+
+	int status = JitExecute((CPU *)state->cpu, (Block *)state->block, index, &context);
+
+	state->elapsed = context.elapsed;
+	state->pending = context.pending;
+	return status;
+}
+
+#endif
@@ -10,7 +10,7 @@
 #include "Log.h"
 #include "Utils.h"
 
-Cartridge::Cartridge(std::filesystem::path romPath) : m_RomBank(1), m_RamEnabled(false)
+Cartridge::Cartridge(std::filesystem::path romPath) : m_RomBank(1), m_RomBankOffset(0), m_RamEnabled(false)
 {
 	std::string logTxt = "Loading ROM file: " + romPath.string();
 	Log::LogInfo(logTxt.c_str());
@@ -308,55 +308,48 @@ Cartridge::Cartridge(std::filesystem::path romPath) : m_RomBank(1), m_RamEnabled
 	this->m_IsValid = true;
 }
 
-unsigned char Cartridge::ReadU8(int address)
+unsigned char Cartridge::ReadBankedU8(int bank, int address)
 {
-	if (m_Hardware.mapper == Mapper::MBC1 || m_Hardware.mapper == Mapper::MBC2)
+	size_t romAddress = address;
+	if ((m_Hardware.mapper == Mapper::MBC1 || m_Hardware.mapper == Mapper::MBC2) && address >= 0x4000)
 	{
-		if(address < 0x4000)
-			return m_Rom[address];
-
-		int bankedAddress = (address - 0x4000) + (m_RomBank * 0x4000);
-		return m_Rom[bankedAddress];
+		romAddress = (address - 0x4000) + ((size_t)bank * 0x4000);
 	}
 
-	return m_Rom[address];
+	return romAddress < m_Rom.size() ? m_Rom[romAddress] : 0xFF;
+}
+
+const unsigned char *Cartridge::GetRomRegion(int address)
+{
+	size_t offset = address < 0x4000 ? 0 : 0x4000 + m_RomBankOffset;
+	return offset + 0x4000 <= m_Rom.size() ? m_Rom.data() + offset : nullptr;
 }
 
-unsigned short Cartridge::ReadU16(int address)
+unsigned int Cartridge::GetChecksum()
 {
-	if (m_Hardware.mapper == Mapper::MBC1 || m_Hardware.mapper == Mapper::MBC2)
+	unsigned int crc = 0xFFFFFFFF;
+	for (unsigned char byte : m_Rom)
 	{
-		if(address < 0x4000)
+		crc ^= byte;
+		for (int i = 0; i < 8; i++)
 		{
-			unsigned char lsb = m_Rom[address];
-			unsigned char msb = m_Rom[address + 1];
-
-			return ((unsigned short)msb << 8) | lsb;
+			crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
 		}
-
-		int bankedAddress = (address - 0x4000) + (m_RomBank * 0x4000);
-
-		unsigned char lsb = m_Rom[bankedAddress];
-		unsigned char msb = m_Rom[bankedAddress + 1];
-
-		return ((unsigned short)msb << 8) | lsb;
 	}
 
-	unsigned char lsb = m_Rom[address];
-	unsigned char msb = m_Rom[address + 1];
-
-	return ((unsigned short)msb << 8) | lsb;
+	return ~crc;
 }
 
-unsigned char Cartridge::ReadU8RAM(int address)
+template <Mapper M>
+unsigned char Cartridge::ReadU8RAMMapped(int address)
 {
 	if(!m_RamEnabled) return 0xFF;
 
-	if(m_Hardware.mapper == Mapper::MBC1)
+	if constexpr (M == Mapper::MBC1)
 	{
 		return m_Ram[address - 0xA000];
 	}
-	else if(m_Hardware.mapper == Mapper::MBC2)
+	else if constexpr (M == Mapper::MBC2)
 	{
 	    if(address > 0xa1ff)
 		{
@@ -396,15 +389,16 @@ unsigned char Cartridge::ReadU16RAM(int address)
 	return ((unsigned short)msb << 8) | lsb;
 }
 
-void Cartridge::WriteU8RAM(int address, unsigned char value)
+template <Mapper M>
+void Cartridge::WriteU8RAMMapped(int address, unsigned char value)
 {
 	if(!m_RamEnabled) return;
 
-	if(m_Hardware.mapper == Mapper::MBC1)
+	if constexpr (M == Mapper::MBC1)
 	{
 		m_Ram[address - 0xA000] = value;
 	}
-	else if(m_Hardware.mapper == Mapper::MBC2)
+	else if constexpr (M == Mapper::MBC2)
 	{
 	    if(address > 0xa1ff)
 		{
@@ -468,9 +462,10 @@ void Cartridge::WriteU16RAM(int address, unsigned char lsb, unsigned char msb)
 	SaveGameToFile();
 }
 
-void Cartridge::CheckROMWrite(int address, unsigned char value)
+template <Mapper M>
+void Cartridge::CheckROMWriteMapped(int address, unsigned char value)
 {
-	if(m_Hardware.mapper == Mapper::MBC1)
+	if constexpr (M == Mapper::MBC1)
 	{
 		if(address <= 0x1FFF) // RAM Enable
 		{
@@ -485,7 +480,7 @@ void Cartridge::CheckROMWrite(int address, unsigned char value)
 			// TO-DO
 		}
 	}
-	else if (m_Hardware.mapper == Mapper::MBC2)
+	else if constexpr (M == Mapper::MBC2)
 	{
 	    if(address <= 0x3fff)
 		{
@@ -499,6 +494,14 @@ void Cartridge::CheckROMWrite(int address, unsigned char value)
 		    }
 		}
 	}
+
+	m_RomBankOffset = ((size_t)m_RomBank - 1) * 0x4000;
+}
+
+template <Mapper M>
+Cartridge::MapperAccess Cartridge::GetMapperAccess()
+{
+	return {&Cartridge::ReadU8RAMMapped<M>, &Cartridge::WriteU8RAMMapped<M>, &Cartridge::CheckROMWriteMapped<M>};
 }
 
 void Cartridge::SetHardware(Mapper mapper, bool ram, bool battery, bool timer, bool rumble, bool sensor)
@@ -509,6 +512,22 @@ void Cartridge::SetHardware(Mapper mapper, bool ram, bool battery, bool timer, b
 	m_Hardware.hasTimer = timer;
 	m_Hardware.hasRumble = rumble;
 	m_Hardware.hasSensor = sensor;
+
+	// Picked once so the accessors don't check the mapper on every access
+	switch (mapper)
+	{
+	case Mapper::MBC1:
+		m_MapperAccess = GetMapperAccess<Mapper::MBC1>();
+		break;
+
+	case Mapper::MBC2:
+		m_MapperAccess = GetMapperAccess<Mapper::MBC2>();
+		break;
+
+	default:
+		m_MapperAccess = GetMapperAccess<Mapper::None>();
+		break;
+	}
 }
 
 void Cartridge::SaveGameToFile()
@@ -0,0 +1,104 @@
+#include "Coverage.h"
+
+#include <fstream>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+
+#include "Log.h"
+
+/* Append a 32-bit value in little endian.
+ * @param header Output bytes.
+ * @param value Value to append.
+ */
+static void AppendU32(std::vector<unsigned char> &header, unsigned int value)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		header.push_back((value >> (8 * i)) & 0xFF);
+	}
+}
+
+/* Count the set bits of a bitmap.
+ * @param bits Bitmap.
+ * @return Number of bits set.
+ */
+static size_t CountBits(const std::vector<unsigned char> &bits)
+{
+	size_t count = 0;
+	for (unsigned char byte : bits)
+	{
+		for (; byte != 0; byte &= byte - 1) count++;
+	}
+
+	return count;
+}
+
+Coverage::Coverage(std::filesystem::path outputPath, int romBanks, unsigned int romChecksum) : m_Rom((size_t)romBanks * 0x4000 / 8), m_Ram(0x8000 / 8),
+																							   m_OutputPath(outputPath), m_RomBanks(romBanks), m_RomChecksum(romChecksum)
+{
+}
+
+Coverage::~Coverage()
+{
+	Merge();
+	Save();
+}
+
+void Coverage::Merge()
+{
+	std::ifstream file(m_OutputPath, std::ios::in | std::ios::binary);
+	if (!file) return;
+
+	std::vector<unsigned char> header;
+	header.insert(header.end(), MAGIC, MAGIC + sizeof(MAGIC));
+	AppendU32(header, m_RomChecksum);
+	AppendU32(header, m_RomBanks);
+
+	std::vector<unsigned char> previous(header.size() + m_Rom.size() + m_Ram.size());
+	if (!file.read((char *)previous.data(), previous.size()) || std::memcmp(previous.data(), header.data(), header.size()) != 0)
+	{
+		Log::LogWarning("Coverage file was made for another ROM, overwriting it");
+		return;
+	}
+
+	const unsigned char *bits = previous.data() + header.size();
+	for (size_t i = 0; i < m_Rom.size(); i++)
+	{
+		m_Rom[i] |= bits[i];
+	}
+
+	bits += m_Rom.size();
+	for (size_t i = 0; i < m_Ram.size(); i++)
+	{
+		m_Ram[i] |= bits[i];
+	}
+}
+
+void Coverage::Save()
+{
+	std::ofstream file(m_OutputPath, std::ios::out | std::ios::binary);
+	if (!file)
+	{
+		Log::LogError("Could not save coverage!");
+		return;
+	}
+
+	std::vector<unsigned char> header;
+	header.insert(header.end(), MAGIC, MAGIC + sizeof(MAGIC));
+	AppendU32(header, m_RomChecksum);
+	AppendU32(header, m_RomBanks);
+
+	file.write((const char *)header.data(), header.size());
+	file.write((const char *)m_Rom.data(), m_Rom.size());
+	file.write((const char *)m_Ram.data(), m_Ram.size());
+
+	// Only the first byte of every opcode is marked, the share is of opcode starts over all ROM bytes
+	size_t romBits = CountBits(m_Rom);
+	double share = m_Rom.empty() ? 0.0 : 100.0 * romBits / (m_Rom.size() * 8);
+
+	std::stringstream str;
+	str << std::fixed << std::setprecision(2) << "Coverage: " << romBits << " ROM opcodes (" << share << "% of the ROM bytes), " << CountBits(m_Ram)
+		<< " RAM opcodes, saved to " << m_OutputPath.string();
+	Log::LogInfo(str.str().c_str());
+}
@@ -1,11 +1,16 @@
 #include "GameBoy.h"
 
 #include <filesystem>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+#include <climits>
+#include <algorithm>
 #include <SDL3/SDL.h>
 
 #include "Log.h"
 
-GameBoy::GameBoy(std::filesystem::path romPath, SDL_Window *window) : m_CPU(nullptr), m_PPU(nullptr), m_Valid(true), m_Running(true), m_CycleCount(0), m_DividerCycles(0), m_TimerCycles(0)
+GameBoy::GameBoy(std::filesystem::path romPath, SDL_Window *window) : m_CPU(nullptr), m_PPU(nullptr), m_Valid(true), m_Running(true), m_CycleCount(0), m_HangReason(HangReason::None), m_DividerCycles(0), m_TimerCycles(0)
 {
 	Log::LogInfo("BitDMG v0.7.1");
 
@@ -35,6 +40,18 @@ GameBoy::GameBoy(std::filesystem::path romPath, SDL_Window *window) : m_CPU(null
 	m_PPU = (m_Memory);
 	m_PPU.ConfigureLCD(window);
 
+	m_Memory->SetSyncHandler([this](int cycles)
+	{
+		m_PPU.Tick(cycles * 4);
+		HandleTimer(cycles);
+	});
+
+	// Pre-decoded code is dropped when the game overwrites it, bank switches make the CPU look its block up again
+	m_Memory->SetCodeWriteHandler([this](unsigned short address)
+	{
+		m_CPU.InvalidateCode(address);
+	});
+
 	for (size_t i = 0; i < 8; i++)
 	{
 		m_InputBuffer[i] = false;
@@ -43,6 +60,13 @@ GameBoy::GameBoy(std::filesystem::path romPath, SDL_Window *window) : m_CPU(null
 	Log::LogInfo("Emulator started succesfully!");
 }
 
+GameBoy::~GameBoy()
+{
+#ifdef BITDMG_BLOCK_CACHE
+	if (m_Valid) m_CPU.LogSuperinstructions(m_Cartridge->GetCartName());
+#endif
+}
+
 void GameBoy::Update()
 {
 	SDL_Time startTime;
@@ -150,19 +174,8 @@ void GameBoy::Update()
 	}
 	m_Memory->UpdateInputState(m_InputBuffer);
 
-	while (m_CycleCount < MAX_CYCLES)
-	{
-		int cycles = m_CPU.Cycle();
-		m_CycleCount += cycles * 4; // Transform M-Cycles to Clock Cycles
-		m_Running = cycles != -1;
-
-		m_PPU.Tick(cycles * 4);
-
-		HandleTimer(cycles);
-	}
-
+	RunFrame();
 	m_PPU.Render();
-	m_CycleCount = 0;
 
 	// Limit FPS to ~60 (GameBoy runs slightly slower than 60 FPS)
 	SDL_Time endTime;
@@ -177,6 +190,170 @@ void GameBoy::Update()
 	}
 }
 
+void GameBoy::Benchmark(int frames)
+{
+	unsigned long long startInstructions = m_CPU.GetInstructionCount();
+	unsigned long long startSkipped = m_CPU.GetSkippedCycles();
+	auto startTime = std::chrono::steady_clock::now();
+
+	int frame = 0;
+	while (frame < frames && m_Running)
+	{
+		RunFrame();
+		frame++;
+	}
+
+	auto endTime = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration<double>(endTime - startTime).count();
+	unsigned long long instructions = m_CPU.GetInstructionCount() - startInstructions;
+	unsigned long long skipped = m_CPU.GetSkippedCycles() - startSkipped;
+
+	// The GameBoy runs at ~59.73 frames per second
+	std::stringstream str;
+	str << std::fixed << std::setprecision(2) << "Benchmark: " << frame << " frames, " << instructions << " instructions in " << seconds << "s ("
+		<< (instructions / seconds) / 1000000.0 << " MIPS, " << (frame / seconds) / 59.73 << "x real time), "
+		<< skipped << " M-Cycles skipped in polling loops";
+	Log::LogInfo(str.str().c_str());
+}
+
+void GameBoy::EnableGuestProfiler(std::filesystem::path outputPath, std::filesystem::path symbolPath)
+{
+	auto profiler = std::make_shared<GuestProfiler>(outputPath);
+
+	if (!symbolPath.empty() && std::filesystem::exists(symbolPath))
+	{
+		profiler->LoadSymbols(symbolPath);
+	}
+
+	m_CPU.SetGuestProfiler(profiler);
+}
+
+void GameBoy::EnableTracer(std::filesystem::path tracePath)
+{
+	auto tracer = std::make_shared<Tracer>(tracePath);
+
+	if (tracer->IsValid())
+	{
+		m_CPU.SetTracer(tracer);
+	}
+}
+
+void GameBoy::EnableCoverage(std::filesystem::path coveragePath)
+{
+	m_CPU.SetCoverage(std::make_shared<Coverage>(coveragePath, m_Cartridge->GetRomBankCount(), m_Cartridge->GetChecksum()));
+}
+
+void GameBoy::EnableTraceComparer(std::filesystem::path referencePath)
+{
+	auto comparer = std::make_shared<TraceComparer>(referencePath);
+
+	if (comparer->IsValid())
+	{
+		m_CPU.SetTraceComparer(comparer);
+	}
+}
+
+void GameBoy::EnableJitVerify()
+{
+	m_CPU.SetJitVerify(true);
+}
+
+void GameBoy::EnableRecompiledCode()
+{
+#ifdef BITDMG_STATIC_RECOMPILER
+	auto module = RecompiledModule::Load(*m_Cartridge);
+
+	if (module)
+	{
+		m_CPU.SetRecompiledModule(module);
+	}
+#else
+	Log::LogWarning("BitDMG was built without BITDMG_STATIC_RECOMPILER, running the interpreter");
+#endif
+}
+
+void GameBoy::EnableWatchdog()
+{
+	m_Watchdog = std::make_shared<Watchdog>();
+}
+
+void GameBoy::RunFrame()
+{
+	while (m_CycleCount < MAX_CYCLES && m_Running)
+	{
+		// A halted CPU only wakes up on an interrupt & polling loops wait for the PPU or timer,
+		// jump straight to the next event that could change that
+		int cycles = 0;
+		if (m_CPU.IsHalted())
+			cycles = m_CPU.SkipHalt(GetCyclesUntilNextEvent());
+		else if (m_CPU.IsIdleLoop())
+			cycles = m_CPU.SkipIdleLoop(GetCyclesUntilNextEvent());
+
+		if (cycles > 0)
+		{
+			m_CycleCount += cycles * 4;
+			m_PPU.Tick(cycles * 4);
+			HandleTimer(cycles);
+			if (m_Watchdog) m_Watchdog->Sample(m_CPU.GetPC(), m_CPU.IsIMEEnabled());
+			continue;
+		}
+
+		// Nothing outside the CPU happens until the next event, the PPU & timers catch up when the CPU reads or writes them
+		cycles = m_CPU.RunUntil(GetCyclesUntilNextEvent());
+		m_CycleCount += cycles * 4; // Transform M-Cycles to Clock Cycles
+		m_Running = cycles != -1;
+		if (m_Watchdog) m_Watchdog->Sample(m_CPU.GetPC(), m_CPU.IsIMEEnabled());
+	}
+
+	m_CycleCount = 0;
+	if (m_Watchdog) CheckWatchdog();
+}
+
+void GameBoy::CheckWatchdog()
+{
+	// RunUntil also returns -1 once a reference trace ended
+	HangReason reason;
+	if (!m_Running) reason = m_CPU.IsLockedUp() ? HangReason::LockedUp : HangReason::None;
+	else reason = m_Watchdog->CheckFrame(m_CPU.IsHalted(), m_Memory->ReadU8Unfiltered(IO::IE), m_Memory->GetIOWriteCount());
+
+	if (reason == HangReason::None) return;
+
+	m_HangReason = reason;
+	m_Running = false;
+
+	// One line of key=value pairs so batch jobs can parse it
+	std::stringstream str;
+	str << "Watchdog: reason=" << Watchdog::GetReasonName(reason) << " code=" << (int)reason << " instructions=" << m_CPU.GetInstructionCount() << " ";
+
+	if (reason == HangReason::TightLoop)
+	{
+		unsigned int range = m_Watchdog->GetRange();
+		str << std::hex << std::uppercase << std::setfill('0') << "range=" << std::setw(4) << (range >> 16) << "-" << std::setw(4) << (range & 0xFFFF) << " ";
+	}
+
+	str << m_CPU.GetStateDump();
+	Log::LogError(str.str().c_str());
+}
+
+int GameBoy::GetCyclesUntilNextEvent()
+{
+	// Never skip past the end of the frame
+	int cycles = (MAX_CYCLES - m_CycleCount + 3) / 4;
+
+	// PPU works in T-Cycles, round up to the M-Cycle in which the event happens
+	int ppuCycles = m_PPU.GetCyclesUntilNextEvent();
+	if (ppuCycles != INT_MAX) cycles = std::min(cycles, (ppuCycles + 3) / 4);
+
+	unsigned char TAC = m_Memory->ReadU8(IO::TAC);
+	if ((TAC & 0x4) >> 2) // If timer enabled
+	{
+		int increments = 0x100 - m_Memory->ReadU8(IO::TIMA);
+		cycles = std::min(cycles, increments * GetTimerFrequency(TAC) - m_TimerCycles);
+	}
+
+	return std::max(cycles, 1);
+}
+
 bool GameBoy::IsValid()
 {
 	return m_Valid;
@@ -193,35 +370,20 @@ void GameBoy::HandleTimer(int mCycles)
 	m_DividerCycles += mCycles;
 	if (m_DividerCycles >= 64)
 	{
-		m_Memory->WriteU8Unfiltered(IO::DIV, m_Memory->ReadU8(IO::DIV) + 1);
+		m_Memory->WriteU8Unfiltered(IO::DIV, m_Memory->ReadU8(IO::DIV) + m_DividerCycles / 64);
+		m_DividerCycles %= 64;
 	}
 
-	m_TimerCycles += mCycles;
 	unsigned char TAC = m_Memory->ReadU8(IO::TAC);
 	if ((TAC & 0x4) >> 2) // If timer enabled
 	{
-		int freq = 256;
+		int freq = GetTimerFrequency(TAC);
 
-		switch (TAC & 0x3)
-		{
-		case 0b00:
-			freq = 256;
-			break;
-
-		case 0b01:
-			freq = 4;
-			break;
+		// Only counts while enabled, cycles spent disabled must not be replayed when the timer starts
+		m_TimerCycles += mCycles;
 
-		case 0b10:
-			freq = 16;
-			break;
-
-		case 0b11:
-			freq = 64;
-			break;
-		}
-
-		if (m_TimerCycles >= freq)
+		// Several increments might be due if the timer was advanced by more than one period
+		while (m_TimerCycles >= freq)
 		{
 			unsigned char TIMA = m_Memory->ReadU8(IO::TIMA);
 
@@ -237,3 +399,21 @@ void GameBoy::HandleTimer(int mCycles)
 		}
 	}
 }
+
+int GameBoy::GetTimerFrequency(unsigned char TAC)
+{
+	switch (TAC & 0x3)
+	{
+	case 0b01:
+		return 4;
+
+	case 0b10:
+		return 16;
+
+	case 0b11:
+		return 64;
+
+	default:
+		return 256;
+	}
+}
@@ -0,0 +1,129 @@
+#include "GuestProfiler.h"
+
+#include <fstream>
+#include <cstdio>
+#include <sstream>
+#include <iomanip>
+
+#include "Log.h"
+
+GuestProfiler::GuestProfiler(std::filesystem::path outputPath, int period) : m_OutputPath(outputPath), m_Period(period), m_Cycles(0)
+{
+}
+
+GuestProfiler::~GuestProfiler()
+{
+	Save();
+}
+
+bool GuestProfiler::LoadSymbols(std::filesystem::path symbolPath)
+{
+	std::ifstream file(symbolPath);
+	if (!file)
+	{
+		std::string logTxt = "Could not open symbol file: " + symbolPath.string();
+		Log::LogWarning(logTxt.c_str());
+		return false;
+	}
+
+	std::string line;
+	while (std::getline(file, line))
+	{
+		// Comments start with ';'
+		line = line.substr(0, line.find(';'));
+
+		// "BB:AAAA Name"
+		unsigned int bank, address;
+		char name[256];
+		if (std::sscanf(line.c_str(), "%x:%x %255s", &bank, &address, name) != 3) continue;
+
+		m_Symbols[(bank << 16) | address] = name;
+	}
+
+	std::string logTxt = "Loaded " + std::to_string(m_Symbols.size()) + " symbols from " + symbolPath.string();
+	Log::LogInfo(logTxt.c_str());
+	return true;
+}
+
+void GuestProfiler::Call(unsigned short returnAddress, unsigned char bank, unsigned short sp)
+{
+	// Games that never return (jumping out of a function with the stack reset) would grow it forever
+	if (m_CallStack.size() >= 256) m_CallStack.clear();
+
+	m_CallStack.push_back({((unsigned int)bank << 16) | returnAddress, sp});
+}
+
+void GuestProfiler::Return(unsigned short sp)
+{
+	// Frames below the return address were left without returning (stack manipulated by hand)
+	while (!m_CallStack.empty() && m_CallStack.back().sp <= sp)
+	{
+		m_CallStack.pop_back();
+	}
+}
+
+void GuestProfiler::Sample(unsigned short pc, unsigned char bank)
+{
+	int samples = m_Cycles / m_Period;
+	m_Cycles %= m_Period;
+
+	std::vector<unsigned int> stack;
+	stack.reserve(m_CallStack.size() + 1);
+
+	for (const Frame &frame : m_CallStack)
+	{
+		stack.push_back(FindSymbol(frame.location));
+	}
+
+	// Callers come from the return addresses, the function being executed from PC
+	stack.push_back(FindSymbol(((unsigned int)bank << 16) | pc));
+
+	m_Samples[stack] += samples;
+}
+
+unsigned int GuestProfiler::FindSymbol(unsigned int location)
+{
+	auto symbol = m_Symbols.upper_bound(location);
+	if (symbol == m_Symbols.begin()) return location;
+
+	// Symbols don't span across banks
+	symbol--;
+	if ((symbol->first >> 16) != (location >> 16)) return location;
+
+	return symbol->first;
+}
+
+std::string GuestProfiler::GetName(unsigned int location)
+{
+	auto symbol = m_Symbols.find(location);
+	if (symbol != m_Symbols.end()) return symbol->second;
+
+	std::stringstream str;
+	str << std::hex << std::uppercase << std::setfill('0') << std::setw(2) << (location >> 16) << ":" << std::setw(4) << (location & 0xFFFF);
+	return str.str();
+}
+
+void GuestProfiler::Save()
+{
+	std::ofstream file(m_OutputPath);
+	if (!file)
+	{
+		Log::LogError("Could not save guest profile!");
+		return;
+	}
+
+	// One "frame;frame;frame count" line per call stack
+	for (const auto &[stack, samples] : m_Samples)
+	{
+		for (size_t i = 0; i < stack.size(); i++)
+		{
+			if (i > 0) file << ";";
+			file << GetName(stack[i]);
+		}
+
+		file << " " << samples << "\n";
+	}
+
+	std::string logTxt = "Guest profile saved to " + m_OutputPath.string();
+	Log::LogInfo(logTxt.c_str());
+}
@@ -0,0 +1,55 @@
+#include "Jit.h"
+
+#ifdef BITDMG_JIT
+
+#if !defined(__linux__) || !defined(__x86_64__)
+#error "BITDMG_JIT is only supported on Linux x86-64"
+#endif
+
+#include <string>
+#include <cstring>
+#include <sys/mman.h>
+
+#include "Log.h"
+
+Jit::Jit(size_t size) : m_Memory(nullptr), m_Size(size), m_Used(0), m_Verify(false), m_Compiled(0), m_Verified(0), m_Mismatches(0)
+{
+	void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED)
+	{
+		Log::LogError("Could not map executable memory for the JIT!");
+		return;
+	}
+
+	m_Memory = (unsigned char *)memory;
+}
+
+Jit::~Jit()
+{
+	if (m_Memory != nullptr) munmap(m_Memory, m_Size);
+
+	std::string logTxt = "JIT: " + std::to_string(m_Compiled) + " blocks compiled";
+	if (m_Verify) logTxt += ", " + std::to_string(m_Verified) + " opcodes verified against the interpreter, " + std::to_string(m_Mismatches) + " mismatches";
+	Log::LogCustom(logTxt.c_str(), "JIT");
+}
+
+void *Jit::Add(const std::vector<unsigned char> &code)
+{
+	// Keep blocks 16 bytes aligned
+	size_t size = (code.size() + 15) & ~(size_t)15;
+	if (m_Memory == nullptr || m_Used + size > m_Size) return nullptr;
+
+	void *start = m_Memory + m_Used;
+	std::memcpy(start, code.data(), code.size());
+
+	m_Used += size;
+	m_Compiled++;
+	return start;
+}
+
+void Jit::Reset()
+{
+	m_Used = 0;
+}
+
+#endif
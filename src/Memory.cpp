@@ -7,9 +7,21 @@
 #include "Log.h"
 #include "Utils.h"
 
-Memory::Memory(std::shared_ptr<Cartridge> cart) : m_Cartridge(cart), m_VramLocked(false), m_OamLocked(false)
+Memory::Memory(std::shared_ptr<Cartridge> cart) : m_Cartridge(cart), m_VramLocked(false), m_OamLocked(false), m_InterruptPending(false), m_PendingCycles(0), m_ScheduleChanged(false), m_IOWrites(0)
 {
 	m_Memory.fill(0);
+	m_CodePages.fill(false);
+
+	m_ReadPages.fill(nullptr);
+	m_WritePages.fill(nullptr);
+	UpdateRomPages();
+
+	// WRAM & Echo RAM have no side effects, Echo RAM pages point at the WRAM they alias
+	for (int page = 0xC0; page <= 0xFD; page++)
+	{
+		m_ReadPages[page] = m_Memory.data() + ResolveEcho(page * MEMORY_PAGE_SIZE);
+		UpdateWritePage(page * MEMORY_PAGE_SIZE);
+	}
 
 	// Mimic hardware register's state after boot ROM
 	m_Memory[IO::JOY] = 0xCF;
@@ -52,10 +64,22 @@ Memory::Memory(std::shared_ptr<Cartridge> cart) : m_Cartridge(cart), m_VramLocke
 	m_Memory[IO::WY] = 0x00; 
 	m_Memory[IO::WX] = 0x00; 
 	m_Memory[IO::IE] = 0x00; 
+	CheckInterruptWrite(IO::IE);
 }
 
-unsigned char Memory::ReadU8(unsigned short address)
+unsigned char Memory::ReadU8Slow(unsigned short address)
 {
+	// HRAM & IE share their page with the IO registers
+	if (address >= 0xFF80) return m_Memory[address];
+
+	SyncAccess(address);
+
+	// IO registers
+	if (address >= 0xFF00)
+	{
+		return (this->*s_IOTable[address & 0xFF].read)(address);
+	}
+
 	// Cartridge ROM
 	if (address <= 0x7FFF)
 	{
@@ -86,19 +110,6 @@ unsigned char Memory::ReadU8(unsigned short address)
 		return m_OamLocked ? 0xFF : 0x00;
 	}
 
-	// Joypad register
-	if (address == IO::JOY)
-	{
-		UpdateInputRegister();
-		return m_Memory[address];
-	}
-
-	// Serial
-	if (address == IO::SB)
-	{
-		return 0xFF;
-	}
-
 	return m_Memory[address];
 }
 
@@ -116,15 +127,35 @@ unsigned char Memory::ReadU8Unfiltered(unsigned short address)
 		return m_Cartridge->ReadU8RAM(address);
 	}
 
-	return m_Memory[address];
+	return m_Memory[ResolveEcho(address)];
 }
 
-void Memory::WriteU8(unsigned short address, unsigned char value)
+void Memory::WriteU8Slow(unsigned short address, unsigned char value)
 {
+	// HRAM & IE share their page with the IO registers, only IE has a side effect
+	if (address >= 0xFF80)
+	{
+		if (address == IO::IE) WriteInterrupt(address, value);
+		else WritePlain(address, value);
+		return;
+	}
+
+	SyncAccess(address);
+
+	// IO registers
+	if (address >= 0xFF00)
+	{
+		m_IOWrites++;
+		(this->*s_IOTable[address & 0xFF].write)(address, value);
+		return;
+	}
+
 	// Cartridge ROM -> Update mapper registers
 	if (address <= 0x7FFF)
 	{
 		m_Cartridge->CheckROMWrite(address, value);
+		UpdateRomPages();
+		if (m_CodeWriteHandler) m_CodeWriteHandler(address);
 		return;
 	}
 
@@ -135,16 +166,6 @@ void Memory::WriteU8(unsigned short address, unsigned char value)
 		return;
 	}
 
-	// Trap serial output and log it
-	// if (address == 0xFF01) Log::LogCustom((char*)&value, "SERIAL OUT");
-
-	// Trap the timer's DIV register
-	if (address == IO::DIV)
-	{
-		m_Memory[IO::DIV] = 0x00;
-		return;
-	}
-
 	// VRAM Lock
 	if (address >= 0x8000 && address <= 0x9FFF && m_VramLocked)
 	{
@@ -157,26 +178,9 @@ void Memory::WriteU8(unsigned short address, unsigned char value)
 		return;
 	}
 
-	// DMA Transfer
-	if (address == IO::DMA)
-	{
-		unsigned short source = value * 0x100;
-
-		for (size_t i = 0; i < 159; i++)
-		{
-			m_Memory[0xFE00 + i] = m_Memory[source + i];
-		}
-
-		return;
-	}
-
-	m_Memory[address] = value;
-
-	// Internal RAM, when writting to this area the changes are replicated at Echo RAM
-	if (address >= 0xC000 && address <= 0xDDFF)
-	{
-		m_Memory[address + 0x2000] = value;
-	}
+	unsigned short target = ResolveEcho(address);
+	m_Memory[target] = value;
+	CheckCodeWrite(target);
 }
 
 void Memory::WriteU8Unfiltered(unsigned short address, unsigned char value)
@@ -185,6 +189,8 @@ void Memory::WriteU8Unfiltered(unsigned short address, unsigned char value)
 	if (address <= 0x7FFF)
 	{
 		m_Cartridge->CheckROMWrite(address, value);
+		UpdateRomPages();
+		if (m_CodeWriteHandler) m_CodeWriteHandler(address);
 		return;
 	}
 
@@ -195,30 +201,17 @@ void Memory::WriteU8Unfiltered(unsigned short address, unsigned char value)
 		return;
 	}
 
-	// DMA Transfer
-	if (address == IO::DMA)
-	{
-		unsigned short source = value * 0x100;
-
-		for (size_t i = 0; i < 159; i++)
-		{
-			m_Memory[0xFE00 + i] = m_Memory[source + i];
-		}
-
-		return;
-	}
-
-	m_Memory[address] = value;
-
-	// Internal RAM, when writting to this area the changes are replicated at Echo RAM
-	if (address >= 0xC000 && address <= 0xDDFF)
-	{
-		m_Memory[address + 0x2000] = value;
-	}
+	unsigned short target = ResolveEcho(address);
+	m_Memory[target] = value;
+	CheckInterruptWrite(target);
+	CheckCodeWrite(target);
 }
 
 unsigned short Memory::ReadU16(unsigned short address)
 {
+	SyncAccess(address);
+	SyncAccess(address + 1);
+
 	// Cartridge ROM
 	if (address <= 0x7FFF)
 	{
@@ -249,14 +242,17 @@ unsigned short Memory::ReadU16(unsigned short address)
 		return m_OamLocked ? 0x00FF : 0x0000;
 	}
 
-	unsigned char lsb = m_Memory[address];
-	unsigned char msb = m_Memory[address + 1];
+	unsigned char lsb = m_Memory[ResolveEcho(address)];
+	unsigned char msb = m_Memory[ResolveEcho(address + 1)];
 
 	return ((unsigned short)msb << 8) | lsb;
 }
 
 void Memory::WriteU16(unsigned short address, unsigned short value)
 {
+	SyncAccess(address);
+	SyncAccess(address + 1);
+
 	unsigned char lsb = (unsigned char)value;
 	unsigned char msb = (unsigned char)(value >> 8);
 
@@ -285,19 +281,23 @@ void Memory::WriteU16(unsigned short address, unsigned short value)
 		return;
 	}
 
-	m_Memory[address] = lsb;
-	m_Memory[address + 1] = msb;
+	// Each byte may be in Echo RAM on its own
+	unsigned short low = ResolveEcho(address);
+	unsigned short high = ResolveEcho(address + 1);
 
-	// If we wrote to internal RAM, replicate changes to Echo RAM
-	if (address >= 0xC000 && address <= 0xDDFF)
-	{
-		m_Memory[address + 0x2000] = lsb; // Write to echo RAM
-		m_Memory[address + 0x2001] = msb; // Write to echo RAM
-	}
+	m_Memory[low] = lsb;
+	m_Memory[high] = msb;
+	CheckInterruptWrite(low);
+	CheckInterruptWrite(high);
+	CheckCodeWrite(low);
+	CheckCodeWrite(high);
 }
 
 void Memory::WriteU16(unsigned short address, unsigned char lsb, unsigned char msb)
 {
+	SyncAccess(address);
+	SyncAccess(address + 1);
+
 	// Cartridge ROM, forbidden
 	if (address <= 0x7FFF)
 	{
@@ -323,15 +323,16 @@ void Memory::WriteU16(unsigned short address, unsigned char lsb, unsigned char m
 		return;
 	}
 
-	m_Memory[address] = lsb;
-	m_Memory[address + 1] = msb;
+	// Each byte may be in Echo RAM on its own
+	unsigned short low = ResolveEcho(address);
+	unsigned short high = ResolveEcho(address + 1);
 
-	// If we wrote to internal RAM, replicate changes to Echo RAM
-	if (address >= 0xC000 && address <= 0xDDFF)
-	{
-		m_Memory[address + 0x2000] = lsb; // Write to echo RAM
-		m_Memory[address + 0x2001] = msb; // Write to echo RAM
-	}
+	m_Memory[low] = lsb;
+	m_Memory[high] = msb;
+	CheckInterruptWrite(low);
+	CheckInterruptWrite(high);
+	CheckCodeWrite(low);
+	CheckCodeWrite(high);
 }
 
 void Memory::WriteU16Unfiltered(unsigned short address, unsigned char value)
@@ -346,20 +347,23 @@ void Memory::WriteU16Unfiltered(unsigned short address, unsigned char value)
 		return;
 	}
 
-	m_Memory[address] = lsb;
-	m_Memory[address + 1] = msb;
+	// Each byte may be in Echo RAM on its own
+	unsigned short low = ResolveEcho(address);
+	unsigned short high = ResolveEcho(address + 1);
 
-	// If we wrote to internal RAM, replicate changes to Echo RAM
-	if (address >= 0xC000 && address <= 0xDDFF)
-	{
-		m_Memory[address + 0x2000] = lsb; // Write to echo RAM
-		m_Memory[address + 0x2001] = msb; // Write to echo RAM
-		return;
-	}
+	m_Memory[low] = lsb;
+	m_Memory[high] = msb;
+	CheckInterruptWrite(low);
+	CheckInterruptWrite(high);
+	CheckCodeWrite(low);
+	CheckCodeWrite(high);
 }
 
 void Memory::WriteU16Stack(unsigned short address, unsigned short value)
 {
+	SyncAccess(address - 1);
+	SyncAccess(address);
+
 	unsigned char lsb = (unsigned char)value;
 	unsigned char msb = (unsigned char)(value >> 8);
 
@@ -381,15 +385,16 @@ void Memory::WriteU16Stack(unsigned short address, unsigned short value)
 		return;
 	}
 
-	m_Memory[address] = msb;
-	m_Memory[address - 1] = lsb;
+	// Each byte may be in Echo RAM on its own
+	unsigned short high = ResolveEcho(address);
+	unsigned short low = ResolveEcho(address - 1);
 
-	// If we wrote to internal RAM, replicate changes to Echo RAM
-	if (address >= 0xC000 && address <= 0xDDFF)
-	{
-		m_Memory[address + 0x2000] = msb;
-		m_Memory[address - 0x2001] = lsb;
-	}
+	m_Memory[high] = msb;
+	m_Memory[low] = lsb;
+	CheckInterruptWrite(high);
+	CheckInterruptWrite(low);
+	CheckCodeWrite(high);
+	CheckCodeWrite(low);
 }
 
 void Memory::LockVRAM()
@@ -414,7 +419,8 @@ void Memory::UnlockOAM()
 
 void Memory::RequestInterrupt(InterruptType interrupt)
 {
-	WriteU8Unfiltered(IO::IF, ReadU8(IO::IF) | (1 << (int)interrupt));
+	m_Memory[IO::IF] |= 1 << (int)interrupt;
+	CheckInterruptWrite(IO::IF);
 }
 
 void Memory::UpdateInputState(bool buffer[8])
@@ -425,6 +431,142 @@ void Memory::UpdateInputState(bool buffer[8])
 	}
 }
 
+void Memory::SetSyncHandler(std::function<void(int)> handler)
+{
+	m_SyncHandler = handler;
+}
+
+void Memory::Sync()
+{
+	if (m_PendingCycles == 0) return;
+
+	// Clear before calling, the PPU & timers read their registers through this class too
+	int cycles = m_PendingCycles;
+	m_PendingCycles = 0;
+
+	m_SyncHandler(cycles);
+}
+
+bool Memory::TakeScheduleChange()
+{
+	bool changed = m_ScheduleChanged;
+	m_ScheduleChanged = false;
+
+	return changed;
+}
+
+constexpr std::array<Memory::IORegister, 256> Memory::BuildIOTable()
+{
+	std::array<IORegister, 256> table{};
+	for (IORegister &entry : table)
+	{
+		entry = {&Memory::ReadPlain, &Memory::WritePlain};
+	}
+
+	table[IO::JOY & 0xFF].read = &Memory::ReadJoypad;
+	table[IO::SB & 0xFF].read = &Memory::ReadSerial;
+	table[IO::DIV & 0xFF].write = &Memory::WriteDivider;
+	table[IO::DMA & 0xFF].write = &Memory::WriteDMA;
+	table[IO::IF & 0xFF].write = &Memory::WriteInterrupt;
+	table[IO::IE & 0xFF].write = &Memory::WriteInterrupt;
+
+	// Timer & LCD control decide when the next event happens
+	table[IO::TIMA & 0xFF].write = &Memory::WriteSchedule;
+	table[IO::TMA & 0xFF].write = &Memory::WriteSchedule;
+	table[IO::TAC & 0xFF].write = &Memory::WriteSchedule;
+	table[IO::LCDC & 0xFF].write = &Memory::WriteSchedule;
+
+	return table;
+}
+
+constexpr std::array<Memory::IORegister, 256> Memory::s_IOTable = Memory::BuildIOTable();
+
+unsigned char Memory::ReadPlain(unsigned short address)
+{
+	return m_Memory[address];
+}
+
+unsigned char Memory::ReadJoypad(unsigned short address)
+{
+	UpdateInputRegister();
+	return m_Memory[address];
+}
+
+unsigned char Memory::ReadSerial(unsigned short)
+{
+	// Nothing is ever connected to the link port
+	return 0xFF;
+}
+
+void Memory::WritePlain(unsigned short address, unsigned char value)
+{
+	m_Memory[address] = value;
+	CheckCodeWrite(address);
+}
+
+void Memory::WriteDivider(unsigned short, unsigned char)
+{
+	// Any write resets the divider
+	m_Memory[IO::DIV] = 0x00;
+}
+
+void Memory::WriteDMA(unsigned short, unsigned char value)
+{
+	unsigned short source = value * 0x100;
+
+	for (size_t i = 0; i < 159; i++)
+	{
+		m_Memory[0xFE00 + i] = m_Memory[ResolveEcho(source + i)];
+	}
+}
+
+void Memory::WriteInterrupt(unsigned short address, unsigned char value)
+{
+	WritePlain(address, value);
+	CheckInterruptWrite(address);
+}
+
+void Memory::WriteSchedule(unsigned short address, unsigned char value)
+{
+	WritePlain(address, value);
+	m_ScheduleChanged = true;
+}
+
+void Memory::UpdateRomPages()
+{
+	for (int region = 0; region < 2; region++)
+	{
+		// Banks past the end of the ROM stay on the slow path
+		const unsigned char *rom = m_Cartridge->GetRomRegion(region * 0x4000);
+		for (int i = 0; i < 0x4000 / MEMORY_PAGE_SIZE; i++)
+		{
+			m_ReadPages[region * (0x4000 / MEMORY_PAGE_SIZE) + i] = rom != nullptr ? rom + i * MEMORY_PAGE_SIZE : nullptr;
+		}
+	}
+}
+
+void Memory::UpdateWritePage(unsigned short address)
+{
+	int page = address / MEMORY_PAGE_SIZE;
+	if (page < 0xC0 || page > 0xDF) return;
+
+	bool hasCode = false;
+	for (int i = 0; i < MEMORY_PAGE_SIZE / CODE_PAGE_SIZE; i++)
+	{
+		hasCode |= m_CodePages[page * (MEMORY_PAGE_SIZE / CODE_PAGE_SIZE) + i];
+	}
+
+	// Writes over pre-decoded code have to reach CheckCodeWrite, WRAM up to 0xDDFF is also written through its Echo RAM page
+	unsigned char *backing = hasCode ? nullptr : m_Memory.data() + page * MEMORY_PAGE_SIZE;
+	m_WritePages[page] = backing;
+	if (page <= 0xDD) m_WritePages[page + 0x20] = backing;
+}
+
+void Memory::SetCodeWriteHandler(std::function<void(unsigned short)> handler)
+{
+	m_CodeWriteHandler = handler;
+}
+
 void Memory::UpdateInputRegister()
 {
 	unsigned char P1 = m_Memory[IO::JOY];
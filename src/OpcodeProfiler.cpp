@@ -0,0 +1,53 @@
+#include "OpcodeProfiler.h"
+
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+
+#include "Log.h"
+
+OpcodeProfiler<true>::OpcodeProfiler()
+{
+	m_Count.fill(0);
+	m_Cycles.fill(0);
+}
+
+OpcodeProfiler<true>::~OpcodeProfiler()
+{
+	Print();
+}
+
+void OpcodeProfiler<true>::Print()
+{
+	unsigned long long totalCount = 0;
+	unsigned long long totalCycles = 0;
+	std::array<int, 512> order;
+
+	for (int i = 0; i < 512; i++)
+	{
+		totalCount += m_Count[i];
+		totalCycles += m_Cycles[i];
+		order[i] = i;
+	}
+
+	// Nothing ran (CPUs that were only used to copy from)
+	if (totalCount == 0) return;
+
+	std::stable_sort(order.begin(), order.end(), [this](int a, int b) { return m_Cycles[a] > m_Cycles[b]; });
+
+	std::stringstream str;
+	str << totalCount << " opcodes, " << totalCycles << " M-Cycles";
+	Log::LogCustom(str.str().c_str(), "PROFILER");
+	Log::LogCustom("Opcode          Count     M-Cycles  % Cycles", "PROFILER");
+
+	for (int opcode : order)
+	{
+		if (m_Count[opcode] == 0) break;
+
+		str.str("");
+		str << (opcode >= 0x100 ? "CB " : "   ") << "0x" << std::hex << std::uppercase << std::setw(2) << std::setfill('0') << (opcode & 0xFF)
+			<< std::dec << std::setfill(' ') << std::setw(15) << m_Count[opcode] << std::setw(13) << m_Cycles[opcode]
+			<< std::fixed << std::setprecision(2) << std::setw(9) << (m_Cycles[opcode] * 100.0) / totalCycles << "%";
+		Log::LogCustom(str.str().c_str(), "PROFILER");
+	}
+}
@@ -1,6 +1,8 @@
 ﻿#include "PPU.h"
 
 #include <iostream>
+#include <climits>
+#include <algorithm>
 
 #include "Log.h"
 #include "Utils.h"
@@ -98,7 +100,7 @@ void PPU::Tick(int cycles)
 		{
 			// Reset clock counter & LY
 			m_Clock -= 4560;
-			m_Mem->WriteU8(IO::LY, 0);
+			m_Mem->WriteU8Unfiltered(IO::LY, 0);
 
 			m_Mem->LockOAM();
 
@@ -198,6 +200,31 @@ void PPU::Tick(int cycles)
 	}
 }
 
+int PPU::GetCyclesUntilNextEvent()
+{
+	// Nothing happens until the LCD is enabled again
+	if (GetBit(m_Mem->ReadU8(IO::LCDC), 7) == false) return INT_MAX;
+
+	switch (m_Mode)
+	{
+	// H-Blank
+	case 0:
+		return 204 - m_Clock;
+
+	// V-Blank, LY is incremented every scanline
+	case 1:
+		return std::min(4560 - m_Clock, 456 - m_Clock % 456);
+
+	// OAM Scan
+	case 2:
+		return 80 - m_Clock;
+
+	// Drawing
+	default:
+		return 172 - m_Clock;
+	}
+}
+
 void PPU::PrintTiles()
 {
 	for (int i = 0; i < 6143; i++)
@@ -263,7 +290,7 @@ void PPU::HandleSTAT()
 void PPU::IncrementLY()
 {
 	unsigned char LY = m_Mem->ReadU8(IO::LY) + 1;
-	m_Mem->WriteU8(IO::LY, LY);
+	m_Mem->WriteU8Unfiltered(IO::LY, LY);
 
 	// Compare with LYC
 	unsigned char LYC = m_Mem->ReadU8(IO::LYC);
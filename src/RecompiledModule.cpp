@@ -0,0 +1,150 @@
+#include "RecompiledModule.h"
+
+#ifdef BITDMG_STATIC_RECOMPILER
+
+#if defined(_WIN32)
+#error "BITDMG_STATIC_RECOMPILER needs dlopen, it isn't supported on Windows"
+#endif
+
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <dlfcn.h>
+
+#include "Log.h"
+#include "CPU.h"
+
+RecompiledModule::RecompiledModule(std::filesystem::path libraryPath) : m_Handle(nullptr)
+{
+	void *handle = dlopen(libraryPath.string().c_str(), RTLD_NOW | RTLD_LOCAL);
+	if (handle == nullptr)
+	{
+		std::string logTxt = std::string("Could not load recompiled module: ") + dlerror();
+		Log::LogError(logTxt.c_str());
+		return;
+	}
+
+	auto abi = (const unsigned int *)dlsym(handle, "bitdmg_abi");
+	auto blocks = (const RecompiledBlock *)dlsym(handle, "bitdmg_blocks");
+	auto count = (const unsigned int *)dlsym(handle, "bitdmg_block_count");
+	if (abi == nullptr || blocks == nullptr || count == nullptr || *abi != BITDMG_RECOMPILED_ABI)
+	{
+		Log::LogError("Recompiled module was built for another version of BitDMG!");
+		dlclose(handle);
+		return;
+	}
+
+	for (unsigned int i = 0; i < *count; i++)
+	{
+		m_Blocks[blocks[i].key] = &blocks[i];
+	}
+
+	m_Handle = handle;
+
+	std::string logTxt = "Loaded " + std::to_string(*count) + " recompiled blocks from " + libraryPath.string();
+	Log::LogInfo(logTxt.c_str());
+}
+
+RecompiledModule::~RecompiledModule()
+{
+	if (m_Handle != nullptr) dlclose(m_Handle);
+}
+
+RecompiledFunction RecompiledModule::Find(unsigned int key, unsigned short end, size_t opcodeCount)
+{
+	auto block = m_Blocks.find(key);
+	if (block == m_Blocks.end()) return nullptr;
+
+	// Translated from other bytes (wrong bank guess) or decoded differently, leave it to the interpreter
+	if (block->second->end != end || block->second->opcodeCount != opcodeCount) return nullptr;
+
+	return block->second->function;
+}
+
+std::filesystem::path RecompiledModule::GetCachePath(unsigned int checksum, unsigned long long sourceHash, std::string extension)
+{
+	char name[32];
+	std::snprintf(name, sizeof(name), "%08X-%016llX", checksum, sourceHash);
+
+	return std::filesystem::path(CACHE_DIRECTORY) / (std::string(name) + extension);
+}
+
+unsigned long long RecompiledModule::HashSource(const std::string &source)
+{
+	// 64-bit FNV-1a
+	unsigned long long hash = 0xCBF29CE484222325ULL;
+	for (unsigned char c : source)
+	{
+		hash ^= c;
+		hash *= 0x100000001B3ULL;
+	}
+
+	return hash;
+}
+
+bool RecompiledModule::Create(Cartridge &cartridge)
+{
+	return Create(cartridge, CPU::Recompile(cartridge));
+}
+
+bool RecompiledModule::Create(Cartridge &cartridge, const std::string &source)
+{
+	unsigned long long sourceHash = HashSource(source);
+	std::filesystem::path sourcePath = GetCachePath(cartridge.GetChecksum(), sourceHash, ".cpp");
+	std::filesystem::path libraryPath = GetCachePath(cartridge.GetChecksum(), sourceHash, LIBRARY_EXTENSION);
+
+	std::error_code error;
+	std::filesystem::create_directories(CACHE_DIRECTORY, error);
+
+	std::ofstream file(sourcePath, std::ios::out | std::ios::binary);
+	if (!file)
+	{
+		Log::LogError("Could not create the recompiled source file!");
+		return false;
+	}
+
+	file << source;
+	file.close();
+
+	return Build(sourcePath, libraryPath);
+}
+
+std::shared_ptr<RecompiledModule> RecompiledModule::Load(Cartridge &cartridge)
+{
+	// Translating is cheap next to building, the hash of the output tells if the cached module is still what this build generates
+	std::string source = CPU::Recompile(cartridge);
+	std::filesystem::path libraryPath = GetCachePath(cartridge.GetChecksum(), HashSource(source), LIBRARY_EXTENSION);
+
+	if (std::filesystem::exists(libraryPath))
+	{
+		auto module = std::make_shared<RecompiledModule>(libraryPath);
+		if (module->IsValid()) return module;
+	}
+
+	// Missing or made by another translator, pay the build once
+	if (!Create(cartridge, source)) return nullptr;
+
+	auto module = std::make_shared<RecompiledModule>(libraryPath);
+	return module->IsValid() ? module : nullptr;
+}
+
+bool RecompiledModule::Build(std::filesystem::path sourcePath, std::filesystem::path libraryPath)
+{
+	const char *compiler = std::getenv("CXX");
+	if (compiler == nullptr || compiler[0] == '\0') compiler = "c++";
+
+	std::string command = std::string(compiler) + " -std=c++17 -O2 -shared -fPIC -o \"" + libraryPath.string() + "\" \"" + sourcePath.string() + "\"";
+
+	std::string logTxt = "Building recompiled module: " + command;
+	Log::LogInfo(logTxt.c_str());
+
+	if (std::system(command.c_str()) != 0)
+	{
+		Log::LogError("Could not build the recompiled module!");
+		return false;
+	}
+
+	return true;
+}
+
+#endif
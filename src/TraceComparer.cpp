@@ -0,0 +1,195 @@
+#include "TraceComparer.h"
+
+#include <cstring>
+#include <cstddef>
+
+#include "Log.h"
+
+TraceComparer::TraceComparer(std::filesystem::path referencePath) : m_IsBinary(false), m_IsValid(true), m_Finished(false), m_ChunkSize(0), m_ChunkPosition(0), m_Count(0)
+{
+	m_File.open(referencePath, std::ios::in | std::ios::binary);
+	if (!m_File)
+	{
+		Log::LogError("Could not open reference trace!");
+		m_IsValid = false;
+		return;
+	}
+
+	char magic[sizeof(Tracer::MAGIC)] = {};
+	m_File.read(magic, sizeof(magic));
+	m_IsBinary = m_File.gcount() == sizeof(magic) && std::memcmp(magic, Tracer::MAGIC, sizeof(magic)) == 0;
+
+	if (m_IsBinary)
+	{
+		m_Chunk.resize(4096);
+	}
+	else
+	{
+		// Text log, start over
+		m_File.clear();
+		m_File.seekg(0);
+	}
+
+	std::string logTxt = std::string("Comparing against ") + (m_IsBinary ? "binary" : "text") + " reference trace " + referencePath.string();
+	Log::LogInfo(logTxt.c_str());
+}
+
+TraceComparer::~TraceComparer()
+{
+	if (!m_IsValid || m_Finished) return;
+
+	std::string logTxt = "Trace comparison stopped, " + std::to_string(m_Count) + " instructions matched";
+	Log::LogInfo(logTxt.c_str());
+}
+
+void TraceComparer::Compare(const TraceRecord &record)
+{
+	if (m_Finished) return;
+
+	TraceRecord expected;
+	if (!ReadReference(expected))
+	{
+		if (!m_Finished)
+		{
+			std::string logTxt = "Reference trace ended, " + std::to_string(m_Count) + " instructions matched";
+			Log::LogInfo(logTxt.c_str());
+		}
+
+		m_Finished = true;
+		return;
+	}
+
+	// Everything after the cycle stamp: SP, PC, registers & PCMEM
+	constexpr size_t stateOffset = offsetof(TraceRecord, sp);
+	if (std::memcmp((const char *)&expected + stateOffset, (const char *)&record + stateOffset, sizeof(TraceRecord) - stateOffset) != 0)
+	{
+		LogMismatch(expected, record);
+		m_Finished = true;
+		return;
+	}
+
+	m_History[m_Count % WINDOW_SIZE] = record;
+	m_Count++;
+}
+
+bool TraceComparer::ReadReference(TraceRecord &record)
+{
+	if (m_IsBinary)
+	{
+		if (m_ChunkPosition == m_ChunkSize)
+		{
+			m_File.read((char *)m_Chunk.data(), m_Chunk.size() * sizeof(TraceRecord));
+			m_ChunkSize = m_File.gcount() / sizeof(TraceRecord);
+			m_ChunkPosition = 0;
+
+			if (m_ChunkSize == 0) return false;
+		}
+
+		record = m_Chunk[m_ChunkPosition++];
+		return true;
+	}
+
+	// Skip empty lines (trailing line break, CRLF logs)
+	while (std::getline(m_File, m_Line))
+	{
+		if (m_Line.empty() || m_Line == "\r") continue;
+
+		if (!ParseLine(m_Line, record))
+		{
+			std::string logTxt = "Malformed reference trace line after " + std::to_string(m_Count) + " instructions: " + m_Line;
+			Log::LogError(logTxt.c_str());
+			m_Finished = true;
+			return false;
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+bool TraceComparer::ParseLine(const std::string &line, TraceRecord &record)
+{
+	// Fixed width, 'x' is a hex digit & everything else has to match
+	static constexpr char FORMAT[] = "A:xx F:xx B:xx C:xx D:xx E:xx H:xx L:xx SP:xxxx PC:xxxx PCMEM:xx,xx,xx,xx";
+	if (line.size() < sizeof(FORMAT) - 1) return false;
+
+	unsigned int values[14] = {};
+	int field = -1;
+
+	for (size_t i = 0; i < sizeof(FORMAT) - 1; i++)
+	{
+		char c = line[i];
+
+		if (FORMAT[i] != 'x')
+		{
+			if (c != FORMAT[i]) return false;
+			continue;
+		}
+
+		// First digit of a field
+		if (FORMAT[i - 1] != 'x') field++;
+
+		int digit;
+		if (c >= '0' && c <= '9') digit = c - '0';
+		else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+		else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+		else return false;
+
+		values[field] = (values[field] << 4) | digit;
+	}
+
+	record.cycle = 0;
+	record.a = values[0];
+	record.f = values[1];
+	record.b = values[2];
+	record.c = values[3];
+	record.d = values[4];
+	record.e = values[5];
+	record.h = values[6];
+	record.l = values[7];
+	record.sp = values[8];
+	record.pc = values[9];
+
+	for (int i = 0; i < 4; i++)
+	{
+		record.pcmem[i] = values[10 + i];
+	}
+
+	return true;
+}
+
+void TraceComparer::LogMismatch(const TraceRecord &expected, const TraceRecord &actual)
+{
+	std::string logTxt = "Trace mismatch at instruction " + std::to_string(m_Count);
+	Log::LogError(logTxt.c_str());
+
+	char line[96];
+	std::string txt;
+
+	// Matching records before the mismatch
+	unsigned long long first = m_Count > WINDOW_SIZE ? m_Count - WINDOW_SIZE : 0;
+	for (unsigned long long i = first; i < m_Count; i++)
+	{
+		Tracer::FormatRecord(m_History[i % WINDOW_SIZE], line);
+		txt = "  " + std::string(line);
+		Log::LogCustom(txt.c_str(), "TRACE");
+	}
+
+	Tracer::FormatRecord(expected, line);
+	txt = "- " + std::string(line) + " (reference)";
+	Log::LogCustom(txt.c_str(), "TRACE");
+
+	Tracer::FormatRecord(actual, line);
+	txt = "+ " + std::string(line) + " (emulator)";
+	Log::LogCustom(txt.c_str(), "TRACE");
+
+	// What the reference does next
+	TraceRecord next;
+	for (size_t i = 0; i < WINDOW_SIZE && ReadReference(next); i++)
+	{
+		Tracer::FormatRecord(next, line);
+		txt = "  " + std::string(line);
+		Log::LogCustom(txt.c_str(), "TRACE");
+	}
+}
@@ -0,0 +1,127 @@
+#include "Tracer.h"
+
+#include <cstdio>
+#include <algorithm>
+#include <cstring>
+#include <chrono>
+
+#include "Log.h"
+
+Tracer::Tracer(std::filesystem::path tracePath) : m_Buffer(BUFFER_SIZE), m_Head(0), m_Tail(0), m_Running(true), m_Cycle(0), m_IsValid(true)
+{
+	m_File.open(tracePath, std::ios::out | std::ios::binary);
+	if (!m_File)
+	{
+		Log::LogError("Could not create trace file!");
+		m_IsValid = false;
+		return;
+	}
+
+	m_File.write(MAGIC, sizeof(MAGIC));
+	m_Writer = std::thread(&Tracer::WriteLoop, this);
+}
+
+Tracer::~Tracer()
+{
+	m_Running = false;
+
+	if (m_Writer.joinable()) m_Writer.join();
+}
+
+void Tracer::Push(TraceRecord record)
+{
+	if (!m_IsValid) return;
+
+	record.cycle = m_Cycle;
+
+	size_t head = m_Head.load(std::memory_order_relaxed);
+
+	// Never drop records, wait for the writer to make room
+	while (head - m_Tail.load(std::memory_order_acquire) == BUFFER_SIZE)
+	{
+		std::this_thread::yield();
+	}
+
+	m_Buffer[head & (BUFFER_SIZE - 1)] = record;
+	m_Head.store(head + 1, std::memory_order_release);
+}
+
+void Tracer::WriteLoop()
+{
+	while (true)
+	{
+		size_t tail = m_Tail.load(std::memory_order_relaxed);
+		size_t head = m_Head.load(std::memory_order_acquire);
+
+		if (head == tail)
+		{
+			// Stopped & the last records were already written
+			if (!m_Running && m_Head.load(std::memory_order_acquire) == tail) break;
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+
+		// Write up to the end of the buffer, the wrapped part goes in the next iteration
+		size_t start = tail & (BUFFER_SIZE - 1);
+		size_t count = std::min(head - tail, BUFFER_SIZE - start);
+		m_File.write((const char *)&m_Buffer[start], count * sizeof(TraceRecord));
+
+		m_Tail.store(tail + count, std::memory_order_release);
+	}
+
+	m_File.close();
+}
+
+void Tracer::FormatRecord(const TraceRecord &record, char *buffer)
+{
+	std::snprintf(buffer, 96, "A:%02X F:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X SP:%04X PC:%04X PCMEM:%02X,%02X,%02X,%02X",
+				  record.a, record.f, record.b, record.c, record.d, record.e, record.h, record.l, record.sp, record.pc,
+				  record.pcmem[0], record.pcmem[1], record.pcmem[2], record.pcmem[3]);
+}
+
+bool Tracer::ConvertToText(std::filesystem::path tracePath, std::filesystem::path logPath)
+{
+	std::ifstream trace(tracePath, std::ios::in | std::ios::binary);
+	if (!trace)
+	{
+		Log::LogError("Could not open trace file!");
+		return false;
+	}
+
+	char magic[sizeof(MAGIC)];
+	if (!trace.read(magic, sizeof(magic)) || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0)
+	{
+		Log::LogError("Not a BitDMG binary trace!");
+		return false;
+	}
+
+	std::ofstream log(logPath, std::ios::out | std::ios::binary);
+	if (!log)
+	{
+		Log::LogError("Could not create log file!");
+		return false;
+	}
+
+	std::vector<TraceRecord> records(4096);
+	char line[96];
+	unsigned long long count = 0;
+
+	while (trace)
+	{
+		trace.read((char *)records.data(), records.size() * sizeof(TraceRecord));
+		size_t read = trace.gcount() / sizeof(TraceRecord);
+
+		for (size_t i = 0; i < read; i++)
+		{
+			FormatRecord(records[i], line);
+			log << line << '\n';
+		}
+
+		count += read;
+	}
+
+	std::string logTxt = "Converted " + std::to_string(count) + " trace records to " + logPath.string();
+	Log::LogInfo(logTxt.c_str());
+	return true;
+}
@@ -0,0 +1,44 @@
+#include "Watchdog.h"
+
+Watchdog::Watchdog()
+{
+	Reset(0);
+}
+
+HangReason Watchdog::CheckFrame(bool halted, unsigned char ie, unsigned long long ioWrites)
+{
+	// Only an enabled interrupt ends HALT, whatever IME is
+	if (halted && (ie & 0x1F) == 0) return HangReason::HaltedForever;
+
+	// Interrupts, IO writes or a wider loop may still lead somewhere, start over
+	if (halted || m_IMESeen || ioWrites != m_IOWrites || m_MinPC > m_MaxPC || m_MaxPC - m_MinPC >= LOOP_BYTES)
+	{
+		Reset(ioWrites);
+		return HangReason::None;
+	}
+
+	// The range is kept over the window, a loop slowly walking through memory ends up too wide
+	if (++m_Frames >= WINDOW_FRAMES) return HangReason::TightLoop;
+
+	return HangReason::None;
+}
+
+const char *Watchdog::GetReasonName(HangReason reason)
+{
+	switch (reason)
+	{
+	case HangReason::TightLoop: return "tight-loop";
+	case HangReason::HaltedForever: return "halted-forever";
+	case HangReason::LockedUp: return "locked-up";
+	default: return "none";
+	}
+}
+
+void Watchdog::Reset(unsigned long long ioWrites)
+{
+	m_MinPC = 0xFFFF;
+	m_MaxPC = 0x0000;
+	m_IMESeen = false;
+	m_IOWrites = ioWrites;
+	m_Frames = 0;
+}
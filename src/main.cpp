@@ -2,14 +2,37 @@
 #include <iostream>
 #include <fstream>
 #include <cstdio>
+#include <cstdlib>
+#include <string>
 
 #include <SDL3/SDL.h>
 
 #include "Log.h"
 #include "GameBoy.h"
+#include "Tracer.h"
+#include "Cartridge.h"
+#include "RecompiledModule.h"
 
 int main(int argc, char* argv[])
 {
+	// Offline trace conversion, no emulation needed
+	if (argc == 4 && std::string(argv[1]) == "--convert-trace")
+	{
+		return Tracer::ConvertToText(argv[2], argv[3]) ? 0 : 1;
+	}
+
+	// Offline translation of a ROM to the recompiled module cache
+	if (argc == 3 && std::string(argv[1]) == "--recompile")
+	{
+#ifdef BITDMG_STATIC_RECOMPILER
+		Cartridge cartridge(argv[2]);
+		return cartridge.IsValid() && RecompiledModule::Create(cartridge) ? 0 : 1;
+#else
+		Log::LogError("BitDMG was built without BITDMG_STATIC_RECOMPILER");
+		return 1;
+#endif
+	}
+
     // Remap clog to file
     std::ofstream ofs("CPU.log");
     std::clog.rdbuf(ofs.rdbuf());
@@ -51,9 +74,32 @@ int main(int argc, char* argv[])
 
 	SDL_SetRenderVSync(renderer, 1);
 
-    std::filesystem::path romPath;
-    if (argc == 2) romPath = argv[1];
-	else romPath = "Tetris.gb";
+    std::filesystem::path romPath = "Tetris.gb";
+	std::filesystem::path profilePath;
+	std::filesystem::path symbolPath;
+	std::filesystem::path tracePath;
+	std::filesystem::path referencePath;
+	std::filesystem::path coveragePath;
+	int benchmarkFrames = 0;
+	bool jitVerify = false;
+	bool recompiled = false;
+	bool watchdog = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+
+		if (arg == "--benchmark" && i + 1 < argc) benchmarkFrames = std::atoi(argv[++i]);
+		else if (arg == "--profile" && i + 1 < argc) profilePath = argv[++i];
+		else if (arg == "--symbols" && i + 1 < argc) symbolPath = argv[++i];
+		else if (arg == "--trace" && i + 1 < argc) tracePath = argv[++i];
+		else if (arg == "--compare-trace" && i + 1 < argc) referencePath = argv[++i];
+		else if (arg == "--coverage" && i + 1 < argc) coveragePath = argv[++i];
+		else if (arg == "--jit-verify") jitVerify = true;
+		else if (arg == "--recompiled") recompiled = true;
+		else if (arg == "--watchdog") watchdog = true;
+		else romPath = arg;
+	}
 
     GameBoy gb = {romPath, window};
     if (!gb.IsValid())
@@ -66,10 +112,54 @@ int main(int argc, char* argv[])
 		return 1;
 	}
 
-    while(gb.IsRunning())
-    {
-        gb.Update();
-    }
+	if (!profilePath.empty())
+	{
+		// Look for the symbols next to the ROM by default (game.gb -> game.sym)
+		if (symbolPath.empty()) symbolPath = std::filesystem::path(romPath).replace_extension(".sym");
+		gb.EnableGuestProfiler(profilePath, symbolPath);
+	}
+
+	if (!tracePath.empty())
+	{
+		gb.EnableTracer(tracePath);
+	}
+
+	if (!referencePath.empty())
+	{
+		gb.EnableTraceComparer(referencePath);
+	}
+
+	if (!coveragePath.empty())
+	{
+		gb.EnableCoverage(coveragePath);
+	}
+
+	if (jitVerify)
+	{
+		gb.EnableJitVerify();
+	}
+
+	if (recompiled)
+	{
+		gb.EnableRecompiledCode();
+	}
+
+	if (watchdog)
+	{
+		gb.EnableWatchdog();
+	}
+
+	if (benchmarkFrames > 0)
+	{
+		gb.Benchmark(benchmarkFrames);
+	}
+	else
+	{
+		while (gb.IsRunning())
+		{
+			gb.Update();
+		}
+	}
 
 	Log::LogCustom("Shuting down SDL", "SDL");
 
@@ -77,5 +167,6 @@ int main(int argc, char* argv[])
 	SDL_DestroyWindow(window);
 	SDL_Quit();
 
-	return 0;
+	// Lets the scheduler of batch runs tell hangs apart (see HangReason)
+	return (int)gb.GetHangReason();
 }